@@ -203,6 +203,32 @@ void Adafruit_PWMServoDriver::setOutputMode(bool totempole) {
 #endif
 }
 
+/*!
+ *  @brief  Sets when new PWM values take effect (MODE2 OCH). On STOP, every
+ *  board written during one I2C transaction (repeated STARTs included) updates
+ *  at the same final STOP, which lets moves on several boards latch together.
+ *  @param  onAck true to update each channel on its byte's ACK, false to
+ *  update on STOP (power-on default)
+ */
+void Adafruit_PWMServoDriver::setOutputChangeOnAck(bool onAck) {
+  uint8_t oldmode = read8(PCA9685_MODE2);
+  uint8_t newmode = onAck ? (oldmode | MODE2_OCH) : (oldmode & ~MODE2_OCH);
+  write8(PCA9685_MODE2, newmode);
+}
+
+/*!
+ *  @brief  Enables or disables the LED All Call address, a second address
+ *  every board answers, so one write reaches all of them. reset() clears it.
+ *  @param  enable true to answer the All Call address
+ *  @param  addr   7-bit All Call address (PCA9685_ALLCALL_ADDRESS by default)
+ */
+void Adafruit_PWMServoDriver::setAllCall(bool enable, uint8_t addr) {
+  write8(PCA9685_ALLCALLADR, addr << 1);
+  uint8_t oldmode = read8(PCA9685_MODE1) & ~MODE1_RESTART; // no restart
+  write8(PCA9685_MODE1, enable ? (oldmode | MODE1_ALLCAL)
+                               : (oldmode & ~MODE1_ALLCAL));
+}
+
 /*!
  *  @brief  Reads set Prescale from PCA9685
  *  @return prescale value
@@ -257,6 +283,55 @@ uint8_t Adafruit_PWMServoDriver::setPWM(uint8_t num, uint16_t on,
   }
 }
 
+/*!
+ *  @brief  Sets the PWM outputs of several consecutive PCA9685 pins using
+ *  register auto-increment (MODE1_AI, enabled by setPWMFreq/setExtClk), so
+ *  each run of channels goes out as one I2C transaction instead of one per
+ *  pin. Runs longer than the Wire buffer are split into as few transactions
+ *  as the buffer allows. Every pin turns ON at tick 0.
+ *  @param  first First PWM output pin, from 0 to 15
+ *  @param  count Number of consecutive pins to write (first + count <= 16)
+ *  @param  offs  OFF tick for each pin, count entries
+ *  @return 0 if successful, otherwise 1
+ */
+uint8_t Adafruit_PWMServoDriver::setPWMMulti(uint8_t first, uint8_t count,
+                                             const uint16_t *offs) {
+  if (count == 0 || first + count > 16)
+    return 1;
+
+  // 1 register address byte followed by 4 bytes per channel
+  size_t perWrite = (i2c_dev->maxBufferSize() - 1) / 4;
+  if (perWrite == 0)
+    return 1;
+  if (perWrite > 16)
+    perWrite = 16;
+
+  uint8_t buffer[1 + 4 * 16];
+  uint8_t result = 0;
+  while (count > 0) {
+    uint8_t n = (count < perWrite) ? count : perWrite;
+#ifdef ENABLE_DEBUG_OUTPUT
+    Serial.print("Setting PWM ");
+    Serial.print(first);
+    Serial.print("..");
+    Serial.println(first + n - 1);
+#endif
+    buffer[0] = PCA9685_LED0_ON_L + 4 * first;
+    for (uint8_t i = 0; i < n; i++) {
+      buffer[1 + 4 * i] = 0;
+      buffer[2 + 4 * i] = 0;
+      buffer[3 + 4 * i] = offs[i];
+      buffer[4 + 4 * i] = offs[i] >> 8;
+    }
+    if (!i2c_dev->write(buffer, 1 + 4 * n))
+      result = 1;
+    first += n;
+    offs += n;
+    count -= n;
+  }
+  return result;
+}
+
 /*!
  *   @brief  Helper to set pin PWM output. Sets pin without having to deal with
  * on/off tick placement and properly handles a zero value as completely off and
@@ -342,6 +417,29 @@ void Adafruit_PWMServoDriver::writeMicroseconds(uint8_t num,
   setPWM(num, 0, pulse);
 }
 
+/*!
+ *  @brief  Changes the I2C bus clock used to talk to this chip (and every
+ * other device on the same bus). Must be called after begin(), since
+ * Wire.begin() restores the default clock.
+ *  @param  desiredclk The desired I2C SCL frequency in Hz
+ *  @return true if the bus clock was changed, otherwise false
+ */
+bool Adafruit_PWMServoDriver::setI2CSpeed(uint32_t desiredclk) {
+  if (!i2c_dev)
+    return false;
+  return i2c_dev->setSpeed(desiredclk);
+}
+
+/*!
+ *  @brief  Checks that the chip still acknowledges its address
+ *  @return true if the chip ACKs, otherwise false
+ */
+bool Adafruit_PWMServoDriver::detected(void) {
+  if (!i2c_dev)
+    return false;
+  return i2c_dev->detected();
+}
+
 /*!
  *  @brief  Getter for the internally tracked oscillator used for freq
  * calculations
@@ -63,6 +63,7 @@
 #define MODE2_INVRT 0x10  /**< Output logic state inverted */
 
 #define PCA9685_I2C_ADDRESS 0x40      /**< Default PCA9685 I2C Slave Address */
+#define PCA9685_ALLCALL_ADDRESS 0x70  /**< Default LED All Call address (7-bit) */
 #define FREQUENCY_OSCILLATOR 25000000 /**< Int. osc. frequency in datasheet */
 
 #define PCA9685_PRESCALE_MIN 3   /**< minimum prescale value */
@@ -84,12 +85,18 @@ public:
   void setExtClk(uint8_t prescale);
   void setPWMFreq(float freq);
   void setOutputMode(bool totempole);
+  void setOutputChangeOnAck(bool onAck);
+  void setAllCall(bool enable, uint8_t addr = PCA9685_ALLCALL_ADDRESS);
   uint16_t getPWM(uint8_t num, bool off = false);
   uint8_t setPWM(uint8_t num, uint16_t on, uint16_t off);
+  uint8_t setPWMMulti(uint8_t first, uint8_t count, const uint16_t *offs);
   void setPin(uint8_t num, uint16_t val, bool invert = false);
   uint8_t readPrescale(void);
   void writeMicroseconds(uint8_t num, uint16_t Microseconds);
 
+  bool setI2CSpeed(uint32_t desiredclk);
+  bool detected(void);
+
   void setOscillatorFrequency(uint32_t freq);
   uint32_t getOscillatorFrequency(void);
 
@@ -0,0 +1,119 @@
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <Arduino.h>
+
+// ─── Configuration ────────────────────────────────────────────────────────────
+
+// Number of pending commands the Arduino can hold ahead of time.
+// Each slot costs sizeof(Command) = 8 bytes of SRAM; 128 slots = 1 KB of the
+// Mega's 8 KB, leaving plenty for the serial/I2C buffers and the stack.
+// It sizes RemoteControl's queue, so change it here, never from a sketch.
+#define COMMAND_QUEUE_CAPACITY 128
+
+/**
+ * @brief One scheduled servo move (or sentinel) waiting for its time slot.
+ */
+struct Command {
+    uint8_t  targetIndex;     // 1 byte: servo index (0x80+id = pose, 255 = end-of-song)
+    uint8_t  angle;           // 1 byte: angle in degrees (0–180)
+    uint32_t relativeDelay;   // 4 bytes: delay in µs from sync (0–~35 min, see songTime())
+    uint16_t seq;             // 2 bytes: arrival order, breaks ties between equal delays
+};                            // Total: 8 bytes
+
+/**
+ * @brief Fixed-capacity min-heap of Commands ordered by relativeDelay.
+ *
+ * Storage is a statically sized array, so no heap allocation ever happens on
+ * the AVR. peek() is O(1); push() and pop() are O(log n). Commands with the
+ * same delay come out in the order they were pushed, so a fret press and its
+ * pick sent for the same microsecond keep their original order.
+ *
+ * @tparam Capacity  Maximum number of commands held at once (≤ 32767).
+ */
+template <uint16_t Capacity>
+class CommandQueue {
+public:
+    CommandQueue() : count(0), nextSeq(0) {}
+
+    uint16_t size() const     { return count; }
+    uint16_t capacity() const { return Capacity; }
+    bool     empty() const    { return count == 0; }
+    bool     full() const     { return count >= Capacity; }
+
+    // Drop every pending command.
+    void clear() { count = 0; }
+
+    /**
+     * @brief Insert a command, keeping the earliest delay at the head.
+     * @return false if the queue is full (command is discarded)
+     */
+    bool push(const Command& cmd) {
+        if (full()) return false;
+        uint16_t i = count++;
+        heap[i]     = cmd;
+        heap[i].seq = nextSeq++;
+        siftUp(i);
+        return true;
+    }
+
+    // Earliest command; only valid when !empty().
+    const Command& peek() const { return heap[0]; }
+
+    /**
+     * @brief Remove the earliest command.
+     * @return false if the queue was empty
+     */
+    bool pop(Command& out) {
+        if (empty()) return false;
+        out = heap[0];
+        if (--count > 0) {
+            heap[0] = heap[count];
+            siftDown(0);
+        }
+        return true;
+    }
+
+private:
+    // True when a should run before b (earlier delay, then earlier arrival).
+    // Delays are compared by signed difference, like the clock itself, so the
+    // order stays right for any two commands less than 2^31 µs apart.
+    static bool before(const Command& a, const Command& b) {
+        if (a.relativeDelay != b.relativeDelay) {
+            return (int32_t)(a.relativeDelay - b.relativeDelay) < 0;
+        }
+        return (int16_t)(a.seq - b.seq) < 0;  // Wrap-safe sequence compare.
+    }
+
+    void siftUp(uint16_t i) {
+        Command item = heap[i];
+        while (i > 0) {
+            uint16_t parent = (i - 1) / 2;
+            if (!before(item, heap[parent])) break;
+            heap[i] = heap[parent];
+            i = parent;
+        }
+        heap[i] = item;
+    }
+
+    void siftDown(uint16_t i) {
+        Command item = heap[i];
+        for (;;) {
+            uint16_t child = 2 * i + 1;
+            if (child >= count) break;
+            if (child + 1 < count && before(heap[child + 1], heap[child])) {
+                ++child;  // Pick the earlier of the two children.
+            }
+            if (!before(heap[child], item)) break;
+            heap[i] = heap[child];
+            i = child;
+        }
+        heap[i] = item;
+    }
+
+    Command  heap[Capacity];
+    uint16_t count;
+    uint16_t nextSeq;
+};
+
+#endif  // COMMAND_QUEUE_H
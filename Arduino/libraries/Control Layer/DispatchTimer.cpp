@@ -0,0 +1,72 @@
+#include "DispatchTimer.h"
+
+#if USE_DISPATCH_TIMER
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+// Set by the compare interrupt, cleared when the timer is re-armed
+static volatile bool dispatchReady = false;
+
+// Timer ticks per microsecond scaled by 256, so 16 MHz / 64 gives 64 (0.25)
+#define DISPATCH_TICKS_PER_US_X256 \
+    ((uint32_t)((F_CPU / DISPATCH_PRESCALER) * 256UL / 1000000UL))
+
+// Compare match: the deadline has passed (or the longest wait expired).
+// Stop the timer and leave the rest to RemoteControl::handle().
+ISR(TIMER3_COMPA_vect) {
+    TCCR3B = 0;
+    TIMSK3 = 0;
+    dispatchReady = true;
+}
+
+void setupDispatchTimer() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TCCR3B = 0;            // Stopped until armed
+        TCCR3A = 0;            // Normal mode, output pins untouched
+        TIMSK3 = 0;
+        TIFR3  = _BV(OCF3A);   // Clear a stale compare flag
+        dispatchReady = false;
+    }
+}
+
+void armDispatchTimer(uint32_t waitMicros) {
+    uint32_t ticks = (waitMicros * DISPATCH_TICKS_PER_US_X256) >> 8;
+    if (waitMicros > 0xFFFFFFUL || ticks > 0xFFFF) ticks = 0xFFFF;  // Wake early, re-arm then
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TCCR3B = 0;
+        TIMSK3 = 0;
+        if (ticks == 0) {
+            dispatchReady = true;  // Already due: no need for the timer
+        } else {
+            dispatchReady = false;
+            TCNT3  = 0;
+            OCR3A  = (uint16_t)ticks;
+            TIFR3  = _BV(OCF3A);
+            TIMSK3 = _BV(OCIE3A);
+            TCCR3B = _BV(CS31) | _BV(CS30);  // Start, clk/64
+        }
+    }
+}
+
+void disarmDispatchTimer() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TCCR3B = 0;
+        TIMSK3 = 0;
+        dispatchReady = false;
+    }
+}
+
+bool dispatchPending() {
+    return dispatchReady;
+}
+
+#else  // !USE_DISPATCH_TIMER: deadlines are only noticed by loop() polling
+
+void setupDispatchTimer() {}
+void armDispatchTimer(uint32_t) {}
+void disarmDispatchTimer() {}
+bool dispatchPending() { return false; }
+
+#endif  // USE_DISPATCH_TIMER
@@ -0,0 +1,54 @@
+#ifndef DISPATCH_TIMER_H
+#define DISPATCH_TIMER_H
+
+#include <Arduino.h>
+
+// ─── Configuration ────────────────────────────────────────────────────────────
+
+// Hardware-timer dispatch uses Timer3 output compare A, which is free on the
+// Mega (servos are driven by the PCA9685 boards, not the Servo library).
+// Define USE_DISPATCH_TIMER as 0 to fall back to plain loop() polling.
+#ifndef USE_DISPATCH_TIMER
+#if defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+#define USE_DISPATCH_TIMER 1
+#else
+#define USE_DISPATCH_TIMER 0
+#endif
+#endif
+
+// Timer3 runs at F_CPU / 64: 4 µs per tick at 16 MHz, so one compare covers
+// up to 65535 ticks (~262 ms). Longer waits wake early and are re-armed.
+#define DISPATCH_PRESCALER 64UL
+
+// ─── Public API ────────────────────────────────────────────────────────────────
+
+/**
+ * @brief Stop Timer3 and clear any pending dispatch.
+ *
+ * Called once from RemoteControl::begin().
+ */
+void setupDispatchTimer();
+
+/**
+ * @brief Raise the dispatch flag after waitMicros µs.
+ * @param waitMicros  Time until the next command is due (0 = already due)
+ *
+ * Re-arming replaces any earlier deadline.
+ */
+void armDispatchTimer(uint32_t waitMicros);
+
+/**
+ * @brief Stop the timer and clear the dispatch flag.
+ */
+void disarmDispatchTimer();
+
+/**
+ * @brief True once the armed deadline has passed.
+ *
+ * Set from the compare interrupt; the servo writes themselves happen in the
+ * main context, because Wire cannot be used from an ISR. Serial parsing
+ * checks this flag and yields so the due command runs first.
+ */
+bool dispatchPending();
+
+#endif  // DISPATCH_TIMER_H
@@ -0,0 +1,119 @@
+#include "I2CQueue.h"
+#include <Wire.h>
+
+#if USE_ASYNC_I2C
+extern "C" {
+#include <utility/twi.h>
+}
+#endif
+
+// Ring of pending transactions, oldest at head
+struct I2CSlot {
+    uint8_t addr;
+    uint8_t len;
+    bool    stop;     // End with STOP (else repeated START)
+    uint8_t data[I2C_QUEUE_BYTES];
+};
+static I2CSlot  slots[I2C_QUEUE_SLOTS];
+static uint8_t  head  = 0;
+static uint8_t  depth = 0;
+static bool     chainOpen = false;  // Last write started ended without STOP
+
+static I2CQueueStats stats;
+
+// Bus time per byte (address byte included), µs × 256, from the bus clock
+static uint32_t byteTime256 = (9UL * 1000000UL * 256UL) / 100000UL;
+
+// When the transfer in flight was started and how long it should take
+static uint32_t busyStart = 0;
+static uint32_t busyFor   = 0;
+
+void setupI2CQueue(uint32_t busClock) {
+    if (busClock == 0) busClock = 100000UL;
+    byteTime256 = (9UL * 1000000UL * 256UL) / busClock;
+}
+
+/**
+ * @brief Hand the head transaction to the bus and free its slot.
+ *
+ * twi_writeTo() copies the bytes into the core's own buffer and, if an
+ * earlier transfer is still going, waits for it to end first; callers that
+ * must not wait check busFree() before coming here.
+ */
+static void startHead() {
+    I2CSlot& s = slots[head];
+    uint8_t result;
+    uint32_t t0 = micros();
+#if USE_ASYNC_I2C
+    result = twi_writeTo(s.addr, s.data, s.len, /*wait=*/0, s.stop);
+#else
+    Wire.beginTransmission(s.addr);
+    Wire.write(s.data, s.len);
+    result = Wire.endTransmission(s.stop);
+#endif
+    chainOpen = !s.stop;
+    if (result == 0) ++stats.sent;
+    else             ++stats.refused;
+
+    busyStart = micros();
+    uint32_t took = busyStart - t0;
+    stats.busyMicros += took;
+    if (took > stats.maxMicros) stats.maxMicros = took > 0xFFFF ? 0xFFFF : (uint16_t)took;
+    busyFor   = (((uint32_t)s.len + 1) * byteTime256 >> 8) + I2C_QUEUE_MARGIN_US;
+    head = (head + 1) % I2C_QUEUE_SLOTS;
+    --depth;
+}
+
+static bool busFree() {
+    return micros() - busyStart >= busyFor;
+}
+
+bool i2cQueueWrite(uint8_t addr, const uint8_t* data, uint8_t len, bool stop) {
+    if (len == 0 || len > I2C_QUEUE_BYTES) return false;
+    if (depth == I2C_QUEUE_SLOTS) {
+        ++stats.stalls;
+        startHead();                    // Waits only for the transfer in flight.
+    }
+    I2CSlot& s = slots[(head + depth) % I2C_QUEUE_SLOTS];
+    s.addr = addr;
+    s.len  = len;
+    s.stop = stop;
+    memcpy(s.data, data, len);
+    ++depth;
+    ++stats.queued;
+    if (depth > stats.maxDepth) stats.maxDepth = depth;
+    i2cQueuePump();
+    return true;
+}
+
+void i2cQueuePump() {
+    if (depth > 0 && busFree()) startHead();
+}
+
+void i2cQueueFlush() {
+    while (depth > 0) startHead();
+}
+
+void i2cQueueClear() {
+    if (!chainOpen) {
+        depth = 0;
+        return;
+    }
+    // Keep the rest of the open chain, through its STOP
+    uint8_t keep = 0;
+    while (keep < depth && !slots[(head + keep) % I2C_QUEUE_SLOTS].stop) ++keep;
+    depth = (keep < depth) ? keep + 1 : depth;
+}
+
+uint8_t i2cQueueDepth() {
+    return depth;
+}
+
+const I2CQueueStats& i2cQueueStats() {
+    return stats;
+}
+
+void i2cQueueClearPeaks() {
+    stats.maxDepth  = 0;
+    stats.maxMicros = 0;
+}
@@ -0,0 +1,101 @@
+#ifndef I2C_QUEUE_H
+#define I2C_QUEUE_H
+
+#include <Arduino.h>
+
+// ─── Configuration ────────────────────────────────────────────────────────────
+
+// Asynchronous transmit uses the AVR core's twi_writeTo() with wait = 0: the
+// call only starts the transfer and the core's TWI interrupt clocks the bytes
+// out, so the main loop keeps parsing serial input meanwhile. Define
+// USE_ASYNC_I2C as 0 to write every transaction through Wire and wait for it.
+#ifndef USE_ASYNC_I2C
+#if defined(__AVR__)
+#define USE_ASYNC_I2C 1
+#else
+#define USE_ASYNC_I2C 0
+#endif
+#endif
+
+// Transactions waiting for the bus. One slot holds a whole register burst;
+// commitStagedServos() needs at most 6 for all 18 servos (a few more when
+// some go to the All Call address; a full queue just waits).
+#define I2C_QUEUE_SLOTS 8
+
+// Largest transaction: the AVR twi buffer (TWI_BUFFER_LENGTH), so a burst is
+// the register address plus 7 channels of 4 bytes.
+#define I2C_QUEUE_BYTES 32
+
+// Time added to each transaction's estimated bus time before the next one is
+// started, for START/STOP and the ISR's own work.
+#define I2C_QUEUE_MARGIN_US 20
+
+// ─── Public API ────────────────────────────────────────────────────────────────
+
+// Running totals, kept from start-up.
+struct I2CQueueStats {
+    uint16_t queued;    // Transactions accepted by i2cQueueWrite().
+    uint16_t sent;      // Transactions handed to the bus.
+    uint16_t refused;   // Transactions the bus would not start (busy, too long).
+                        // With USE_ASYNC_I2C a board's NACK comes after the
+                        // start and is not seen, so this is not a NACK count.
+    uint16_t stalls;    // Writes that found the queue full and had to wait.
+    uint8_t  maxDepth;  // Most transactions waiting at once.
+    uint16_t maxMicros; // Longest time one transaction held the CPU to start.
+    uint32_t busyMicros;  // Total of those times (the whole transfer without async).
+};
+
+/**
+ * @brief Set the bus clock used to estimate transfer times.
+ * @param busClock  I2C clock in Hz, as returned by setupServoDrivers()
+ */
+void setupI2CQueue(uint32_t busClock);
+
+/**
+ * @brief Queue one write transaction (data is copied) and start it if the
+ *        bus is free.
+ * @param addr  7-bit device address
+ * @param data  Bytes to send, register address first
+ * @param len   Number of bytes (1…I2C_QUEUE_BYTES)
+ * @param stop  false to end with a repeated START instead of a STOP, so the
+ *              next queued write continues the same bus transaction
+ * @return      false if len is out of range (nothing is queued)
+ *
+ * Transactions go out in the order they were queued. If every slot is taken
+ * the call waits for the oldest to go out rather than dropping a move. A
+ * write queued with stop = false must be followed by the rest of its chain.
+ */
+bool i2cQueueWrite(uint8_t addr, const uint8_t* data, uint8_t len, bool stop = true);
+
+/**
+ * @brief Start the next queued transaction once the previous one has had
+ *        time to finish. Never waits; call it from every loop pass.
+ */
+void i2cQueuePump();
+
+/**
+ * @brief Start every queued transaction, waiting for the bus between them.
+ *
+ * Used before a blocking Wire access, so it cannot overtake queued writes;
+ * Wire itself waits for the last transfer to end before starting its own.
+ */
+void i2cQueueFlush();
+
+/**
+ * @brief Drop every transaction that has not been started yet.
+ *
+ * A chain already on the bus is still finished up to its STOP, so the bus is
+ * never left held.
+ */
+void i2cQueueClear();
+
+// Transactions still waiting.
+uint8_t i2cQueueDepth();
+
+// Totals since start-up.
+const I2CQueueStats& i2cQueueStats();
+
+// Restart maxDepth and maxMicros; the totals keep counting.
+void i2cQueueClearPeaks();
+
+#endif  // I2C_QUEUE_H
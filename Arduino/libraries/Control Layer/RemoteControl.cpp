@@ -1,223 +1,915 @@
-#include "RemoteControl.h"
-
-// Markers and packet sizes for serial communication between Pi and Arduino.
-#define SYNC_MARKER         0xAA  // Marker for sync packet.
-#define SYNC_TYPE           0x01  // Expected type value in sync packet.
-#define SYNC_PACKET_SIZE    6     // marker(1) + type(1) + startTime(4).
-
-#define COMMAND_MARKER      0xBB  // Marker for pick/strum command packet.
-#define COMMAND_PACKET_SIZE 7  // marker(1) + target(1) + angle(1) + delay(4)
-
-#define GET_TIME_MARKER       0xCC  // Marker to request current millis().
-#define GET_TIME_PACKET_SIZE  1     // marker(1).
-
-#define END_MARKER        0xDD  // Marker signalling end of song.
-#define END_PACKET_SIZE   5     // marker(1) + relativeDelay(4).
-
-#define STOP_MARKER      0xEE  // STOP: clears buffer, disables sync
-#define RESET_MARKER     0xEF  // RESET: followed by servo neutral angles
-#define MAX_RESET_SERVOS 18    // Number of servos to reset
-
-// Constructor initialises control state without enabling debug or sync.
-RemoteControl::RemoteControl()
-  : commandCount(0), syncReceived(false),
-    syncStartTime(0), debugEnabled(false)
-{}
-
-// Initialise servo drivers and optionally enable debug output.
-void RemoteControl::begin(const uint8_t i2cAddrs[], int addrCount, bool debug) {
-    debugEnabled = debug;
-    // Initialise all PCA9685 boards
-    setupServoDrivers(i2cAddrs, addrCount);
-    if (debugEnabled) {
-        Serial.println("RemoteControl: Servo drivers initialised.");
-    }
-}
-
-// Map a logical servo index to a specific board and channel.
-void RemoteControl::addServo(uint8_t boardIndex,
-                             uint8_t channel,
-                             uint8_t servoIndex) {
-    setServoMapping(servoIndex, boardIndex, channel);
-    if (debugEnabled) {
-        Serial.print("RemoteControl: Mapped servo ");
-        Serial.print(servoIndex);
-        Serial.print(" → board ");
-        Serial.print(boardIndex);
-        Serial.print(", channel ");
-        Serial.println(channel);
-    }
-}
-
-// Main loop entry point to process incoming data and execute pending commands.
-void RemoteControl::handle() {
-    parseSerialData();  // Interpret and buffer any serial packets available.
-    update();           // Perform any commands whose time has arrived.
-}
-
-
-// Parse incoming serial packets and buffer commands accordingly.
-void RemoteControl::parseSerialData() {
-    while (Serial.available() > 0) {
-        int avail  = Serial.available();  // Number of bytes currently in buffer.
-        int marker = Serial.peek();       // Inspect next byte without consuming it.
-            // —— STOP packet ——
-        if (marker == STOP_MARKER && avail >= 1) {
-            Serial.read();  // consume 0xEE
-            commandCount = 0;
-            syncReceived = false;
-            Serial.println("STOPPED");
-            continue;  // Immediate priority: skip further checks.
-        }
-
-        // —— RESET packet ——
-        else if (marker == RESET_MARKER && avail >= (1 + MAX_RESET_SERVOS * 2)) {
-            Serial.read(); // consume 0xEF
-            for (int idx = 0; idx < MAX_RESET_SERVOS; ++idx) {
-                int hi = Serial.read();
-                int lo = Serial.read();
-                int16_t angle = (int16_t)((hi << 8) | lo);
-                setServoAngle(idx, angle);  // Move servo to neutral
-            }
-            if (debugEnabled) Serial.println("RemoteControl: Servos RESET to dynamic angles.");
-            Serial.println("RESET_DONE");
-            continue;  // High priority: skip other checks.
-    }
-
-        /// —— PICK command packet ——
-        if (marker == COMMAND_MARKER && avail >= COMMAND_PACKET_SIZE) {
-            Serial.read();                    // Discard command marker.
-            Command cmd;
-            cmd.targetIndex   = Serial.read();    // 1 byte: servo index
-            cmd.angle         = Serial.read();    // 1 byte: angle in degrees (0-180)
-            // 4 bytes: delay (little-endian)
-            uint32_t d0 = Serial.read();
-            uint32_t d1 = Serial.read();
-            uint32_t d2 = Serial.read();
-            uint32_t d3 = Serial.read();
-            cmd.relativeDelay = d0 | (d1 << 8) | (d2 << 16) | (d3 << 24);
-
-            if (commandCount < MAX_COMMANDS) {
-                commandBuffer[commandCount++] = cmd;  // Buffer the pick command.
-                if (debugEnabled) {
-                    Serial.print("RemoteControl: Buffered PICK T=");
-                    Serial.print(cmd.targetIndex);
-                    Serial.print(" A=");
-                    Serial.print(cmd.angle);
-                    Serial.print(" D=");
-                    Serial.print(cmd.relativeDelay);
-                    Serial.println("ms");  // Report buffered command.
-                }
-            } else {
-                Serial.println("ERROR: command buffer full");
-            }
-            continue;
-        }
-
-        // —— END‐OF‐SONG packet —— 
-        else if (marker == END_MARKER && avail >= END_PACKET_SIZE) {
-            Serial.read();  // consume the 0xDD
-            // read 32‐bit relative delay (little-endian, like pick commands)
-            uint32_t d0 = Serial.read();
-            uint32_t d1 = Serial.read();
-            uint32_t d2 = Serial.read();
-            uint32_t d3 = Serial.read();
-            uint32_t rel = d0 | (d1 << 8) | (d2 << 16) | (d3 << 24);
-
-            // Buffer special command to signal song end (targetIndex=255).
-            if (commandCount < MAX_COMMANDS) {
-                Command cmd;
-                cmd.targetIndex   = 255;      // Special sentinel index.
-                cmd.angle         = 0;        // Angle unused for end marker.
-                cmd.relativeDelay = rel;      // Delay after sync time.
-                commandBuffer[commandCount++] = cmd;  // Add to buffer.
-            }
-            continue;  // Continue parsing further packets.
-        }
-
-        // —— GET_TIME packet ——
-        else if (marker == GET_TIME_MARKER && avail >= GET_TIME_PACKET_SIZE) {
-            Serial.read();               // Consume the 0xCC marker.
-            Serial.print("TIME:");     // Prefix for time reply.
-            Serial.println(millis());    // Send current millis() back.
-            continue;                    // Process any more packets.
-        }
-
-        // —— SYNC packet ——
-        else if (marker == SYNC_MARKER && avail >= SYNC_PACKET_SIZE) {
-            Serial.read();                     // Discard sync marker.
-            int type = Serial.read();         // Read packet type.
-            if (type != SYNC_TYPE) {
-                errorHandler("Unexpected sync packet type");  // Abort on mismatch.
-                return;
-            }
-            uint32_t t = 0;
-            t |= (uint32_t)Serial.read() << 24;  // Assemble startTime MSB.
-            t |= (uint32_t)Serial.read() << 16;
-            t |= (uint32_t)Serial.read() << 8;
-            t |= (uint32_t)Serial.read();       // Assemble LSB.
-            syncStartTime = t;                   // Record base time for commands.
-            syncReceived  = true;                // Enable command execution.
-            commandCount  = 0;                   // Clear any old commands.
-            if (debugEnabled) {
-                Serial.print("RemoteControl: Sync at ");
-                Serial.println(t);               // Log sync timestamp.
-            }
-            continue;
-        }
-        else {
-            break;  // Incomplete or unrecognised packet at buffer front.
-        }
-    }
-}
-
-// Execute buffered commands whose scheduled time has been reached since sync.
-void RemoteControl::update() {
-    if (!syncReceived) return;  // Skip if no sync received.
-
-    unsigned long now = millis();  // Get current time reference.
-    int i = 0;
-    while (i < commandCount) {
-        unsigned long execTime = syncStartTime + commandBuffer[i].relativeDelay;
-        if (now >= execTime) {
-            // is this our end‐of‐song marker?
-            if (commandBuffer[i].targetIndex == 255) {
-                // print DONE and stop accepting further commands
-                Serial.println("DONE");      // Signal end of song.
-                syncReceived = false;         // Stop further execution.
-            }
-            else {
-                // execute pick
-                if (debugEnabled) {
-                    Serial.print("Executing PICK: index=");
-                    Serial.print(commandBuffer[i].targetIndex);
-                    Serial.print(" angle=");
-                    Serial.print(commandBuffer[i].angle);
-                    Serial.print(" pulse=");
-                    Serial.println(angleToPulse(commandBuffer[i].angle)); // print the pulse
-                }
-                setServoAngle(commandBuffer[i].targetIndex,
-                            commandBuffer[i].angle);  // Trigger servo motion.
-            }
-
-            // Remove executed command by shifting buffer left.
-            for (int j = i; j < commandCount - 1; j++) {
-                commandBuffer[j] = commandBuffer[j + 1];
-            }
-            --commandCount;  // Reduce count after removal.
-        } else {
-            ++i;  // Move to next buffered command.
-        }
-    }
-}
-
-// Handle fatal errors by reporting and halting further operation.
-void RemoteControl::errorHandler(const char* msg) {
-    Serial.print("RemoteControl ERROR: ");
-    Serial.println(msg);
-    while (true) {
-        delay(1000);
-        Serial.print("RemoteControl ERROR: ");
-        Serial.println(msg);
-    }
-}
+#include "RemoteControl.h"
+
+// Frame delimiting: every packet from the Pi is sent as
+//   FRAME_FLAG, escaped(seq, type, payload..., crc8), FRAME_FLAG
+// where a byte equal to FRAME_FLAG, FRAME_ESC or STOP_MARKER is sent as
+// FRAME_ESC followed by the byte XOR FRAME_ESC_XOR.
+#define FRAME_FLAG          0x7E  // Starts and ends a frame.
+#define FRAME_ESC           0x7D  // Next byte is XORed with FRAME_ESC_XOR.
+#define FRAME_ESC_XOR       0x20
+#define FRAME_OVERHEAD      3     // seq(1) + type(1) + crc(1).
+#define CRC8_POLY           0x07  // CRC-8, init 0, no final XOR.
+#define NACK_REPEAT_US      50000UL  // Earliest repeat of an unanswered NACK.
+
+// NACK reasons, logged as TEL_NACK's angle byte.
+#define NACK_BAD_CRC        1     // CRC mismatch or frame too short.
+#define NACK_OVERFLOW       2     // Frame longer than FRAME_BUFFER_SIZE.
+#define NACK_GAP            3     // A frame was missing before this one.
+
+// Packet types (the byte after seq) and their payload sizes.
+#define LINK_RESET_MARKER   0xA0  // Restart sequence numbering with this frame.
+
+#define CAPS_MARKER         0xA1  // Request for "CAPS:<rate> <rate>...".
+#define BAUD_MARKER         0xA2  // Switch serial rate: rate(4); "BAUD:<rate>" is sent first.
+#define BAUD_PAYLOAD_SIZE   4
+#define ECHO_MARKER         0xA3  // Reply "ECHO:<payload as hex>", proves a new rate.
+#define BAUD_TRIAL_MS       1000  // A new rate needs a good frame within this time.
+#define BAUD_FALLBACK_BAD_FRAMES 16  // Damaged frames in a row that drop back to BASE_BAUD.
+#define STATS_MARKER        0xA4  // Request for the timing counters: flags(1).
+#define STATS_PAYLOAD_SIZE  1
+#define STATS_CLEAR         0x01  // Flag: restart the counters after replying.
+#define STATS_REPLY_MARKER  0xCB  // Binary reply, see reportStats().
+
+#define SYNC_MARKER         0xAA  // Marker for sync packet.
+#define SYNC_TYPE           0x02  // Expected type value in sync packet (0x02: times in µs).
+#define SYNC_PAYLOAD_SIZE   5     // type(1) + startTime(4, big-endian).
+
+#define COMMAND_MARKER      0xBB  // Marker for pick/strum command packet.
+#define COMMAND_PAYLOAD_SIZE 6    // target(1) + angle(1) + delay(4)
+
+#define BATCH_MARKER        0xBC  // Marker for multi-command batch packet.
+#define BATCH_FIXED_LEN     5     // count(1) + baseDelay(4).
+#define BATCH_RECORD_SIZE   5     // target(1) + angle(1) + offset(3).
+
+#define GET_TIME_MARKER       0xCC  // Marker for a clock probe (request current micros()).
+#define GET_TIME_PAYLOAD_SIZE 1     // probe id(1).
+#define TIME_REPLY_MARKER     0xCD  // Binary reply: marker(1) + probe id(1) + micros(4).
+
+#define CLOCK_ADJ_MARKER       0xCE  // Marker for a drift-correction packet.
+#define CLOCK_ADJ_PAYLOAD_SIZE 12    // refLocal(4) + refSong(4) + ratePpm(4).
+#define MAX_CLOCK_RATE_PPM     10000 // Largest accepted skew correction (1 %).
+
+#define CALIBRATE_MARKER       0xC0  // Marker for a per-servo pulse range upload.
+#define CALIBRATE_PAYLOAD_SIZE 5     // servo(1) + minMicros(2) + maxMicros(2).
+
+#define PULSE_MARKER           0xC1  // Marker for an immediate raw pulse-count move.
+#define PULSE_PAYLOAD_SIZE     3     // servo(1) + count(2).
+
+#define POSE_DEFINE_MARKER     0xC2  // Marker for a pose register upload.
+#define POSE_DEFINE_SIZE       (1 + MAX_SERVOS)  // id(1) + angle per servo.
+
+#define STORE_BEGIN_MARKER     0xB0  // Start an upload: id(4) + count(2) + endTime(4).
+#define STORE_BEGIN_SIZE       10
+#define STORE_DATA_MARKER      0xB1  // index(2) + up to MAX_BATCH_RECORDS stored records.
+#define STORE_DATA_FIXED_LEN   2
+#define STORE_END_MARKER       0xB2  // Finish an upload: crc(1) over every record byte.
+#define STORE_END_SIZE         1
+#define STORE_QUERY_MARKER     0xB3  // Request for "STORED:<id> <count> <capacity>".
+#define PLAY_STORED_MARKER     0xB4  // Play the stored song: start(4) + from(4), song µs.
+#define PLAY_STORED_SIZE       8
+
+#define END_MARKER        0xDD  // Marker signalling end of song.
+#define END_PAYLOAD_SIZE  4     // relativeDelay(4).
+
+#define CREDIT_REPORT_STEP 8  // Freed slots that trigger a FREE report.
+
+#define STOP_MARKER      0xEE  // STOP: clears buffer, disables sync (never framed)
+#define STOP_BURST_LEN   8     // Consecutive 0xEE bytes that stop from anywhere in the stream.
+#define RESET_MARKER     0xEF  // RESET: followed by servo neutral angles
+#define MAX_RESET_SERVOS 18    // Number of servos to reset
+
+// The core's serial receive ring; it drops bytes that arrive while it is full.
+#ifndef SERIAL_RX_BUFFER_SIZE
+#define SERIAL_RX_BUFFER_SIZE 64
+#endif
+
+// Little-endian field readers for packet payloads.
+static uint16_t readUint16LE(const uint8_t* p) {
+    return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t readUint32LE(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+         | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Rates the Mega's 16 MHz clock divides exactly (with U2X) and the 16U2 USB
+// bridge passes through, slowest first.
+static const uint32_t supportedBauds[] = { 115200, 250000, 500000, 1000000 };
+
+static bool baudSupported(uint32_t baud) {
+    for (uint8_t i = 0; i < sizeof(supportedBauds) / sizeof(supportedBauds[0]); ++i) {
+        if (supportedBauds[i] == baud) return true;
+    }
+    return false;
+}
+
+static uint16_t saturate16(uint32_t v) {
+    return v > 0xFFFF ? 0xFFFF : (uint16_t)v;
+}
+
+static uint8_t* putUint16LE(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    return p + 2;
+}
+
+static uint8_t crc8Update(uint8_t crc, uint8_t b) {
+    crc ^= b;
+    for (uint8_t i = 0; i < 8; ++i) {
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ CRC8_POLY) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+// Constructor initialises control state without enabling debug or sync.
+RemoteControl::RemoteControl()
+  : frameLen(0), frameCrc(0), frameState(FRAME_HUNT),
+    rxSeq(0), rxSeqValid(false), nackOutstanding(false), lastNackTime(0),
+    badFrames(0), stopRun(0),
+    linkBaud(BASE_BAUD), trialPrevBaud(BASE_BAUD), trialStart(0),
+    baudTrial(false), badRun(0), i2cRefusedLogged(0),
+    acceptedCount(0), freedSinceReport(0),
+    dispatchArmed(false), armedSeq(0),
+    syncReceived(false), storePlaying(false), storeEndQueued(false),
+    storeNext(0), storeTime(0), storeFrom(0), storeCatchUp(false),
+    syncStartTime(0), clockRefLocal(0), clockRefSong(0),
+    clockRatePpm(0), clockCorrection(0), clockFracAcc(0), clockLastLocal(0),
+    statsPending(false), lastHandle(0), handleSeen(false)
+{
+    memset(poses, POSE_UNCHANGED, sizeof(poses));  // Undefined poses move nothing.
+    memset(catchUp, POSE_UNCHANGED, sizeof(catchUp));
+    clearTimingStats();
+}
+
+// Initialise servo drivers and optionally enable debug telemetry.
+void RemoteControl::begin(const uint8_t i2cAddrs[], int addrCount, bool debug,
+                          uint32_t i2cClock) {
+    telemetry.setEnabled(debug);
+    setupSongStore();  // First: an FRAM's begin() would reset the bus clock.
+    // Initialise all PCA9685 boards
+    uint32_t busClock = setupServoDrivers(i2cAddrs, addrCount, i2cClock);
+    setupDispatchTimer();
+    telemetry.log(TEL_BOOT, 0, 0, 0, busClock / 1000);
+}
+
+// Map a logical servo index to a specific board and channel.
+void RemoteControl::addServo(uint8_t boardIndex,
+                             uint8_t channel,
+                             uint8_t servoIndex) {
+    setServoMapping(servoIndex, boardIndex, channel);
+    telemetry.log(TEL_MAP, servoIndex, boardIndex, 0, channel);
+}
+
+// Map every servo from a slot table, logging each mapping as addServo() does.
+void RemoteControl::addServos(const uint8_t slots[], uint8_t count) {
+    setServoSlots(slots, count);
+    for (uint8_t s = 0; s < count && s < MAX_SERVOS; ++s) {
+        uint8_t slot = servoSlots[s];
+        if (slot != SERVO_UNMAPPED) {
+            telemetry.log(TEL_MAP, s, slotBoard(slot), 0, slotChannel(slot));
+        }
+    }
+}
+
+// Main loop entry point to process incoming data and execute pending commands.
+// Parsing stops early once the dispatch timer reports the head command due,
+// so the move is written without waiting for the rest of the serial input.
+void RemoteControl::handle() {
+    uint32_t t = micros();
+    if (handleSeen) {
+        uint16_t period = saturate16(t - lastHandle);
+        if (period < timing.loopMin) timing.loopMin = period;
+        if (period > timing.loopMax) timing.loopMax = period;
+    }
+    lastHandle = t;
+    handleSeen = true;
+
+    parseSerialData();  // Interpret and buffer any serial packets available.
+    i2cQueuePump();     // Next servo burst, if the last one has gone out.
+    if (i2cQueueStats().refused != i2cRefusedLogged) reportI2C();
+    checkBaudTrial();   // Give up on a new serial rate nothing arrived at.
+    update();           // Perform any commands whose time has arrived.
+    refillFromStore();  // Queue the next stored records when playing locally.
+    if (commandQueue.size() > timing.queueHigh) timing.queueHigh = commandQueue.size();
+    scheduleDispatch(); // Time the next wake-up from the new queue head.
+    sendStats();        // A STATS reply goes ahead of telemetry, once it fits;
+    if (!statsPending) telemetry.drain();  // until then records wait in the ring.
+}
+
+
+// Read serial input byte by byte: STOP bytes are counted here, everything
+// else goes to the frame receiver, which runs each complete packet. A
+// partial frame simply waits in the frame buffer for the rest to arrive.
+void RemoteControl::parseSerialData() {
+    uint32_t t0 = micros();
+    if (Serial.available() >= SERIAL_RX_BUFFER_SIZE - 1) ++timing.rxFull;
+    while (Serial.available() > 0) {
+        if (dispatchPending()) break;     // A command is due: run it first.
+
+        uint8_t b = Serial.read();
+        if (b == STOP_MARKER) {
+            // 0xEE is always escaped inside frames, so a run of them can
+            // only be a STOP burst. Fewer than STOP_BURST_LEN is line noise.
+            if (stopRun == STOP_RUN_HANDLED) continue;   // Tail of a handled burst.
+            if (++stopRun >= STOP_BURST_LEN) emergencyStop();
+            continue;
+        }
+        stopRun = 0;
+        feedFrameByte(b);
+        if (i2cQueueDepth()) i2cQueuePump();  // Keep the bus busy during long input.
+    }
+    uint16_t took = saturate16(micros() - t0);
+    if (took > timing.parseMax) timing.parseMax = took;
+}
+
+// Frame receiver. FRAME_HUNT discards bytes until a flag; after that, data
+// bytes are unescaped into frame[] with a running CRC until the closing
+// flag, which also opens the next frame. Anything malformed is dropped and
+// answered with a NACK, and receiving resumes at the next flag.
+void RemoteControl::feedFrameByte(uint8_t b) {
+    if (b == FRAME_FLAG) {
+        if (frameState == FRAME_ESCAPE) {
+            sendNack(NACK_BAD_CRC);            // Flag right after an escape.
+        } else if (frameState == FRAME_DATA && frameLen > 0) {
+            if (frameLen < FRAME_OVERHEAD || frameCrc != 0) sendNack(NACK_BAD_CRC);
+            else acceptFrame();
+        }
+        frameState = FRAME_DATA;               // Back-to-back flags are empty frames.
+        frameLen   = 0;
+        frameCrc   = 0;
+        return;
+    }
+    if (frameState == FRAME_HUNT) return;
+
+    if (frameState == FRAME_DATA && b == FRAME_ESC) {
+        frameState = FRAME_ESCAPE;
+        return;
+    }
+    if (frameState == FRAME_ESCAPE) {
+        b ^= FRAME_ESC_XOR;
+        frameState = FRAME_DATA;
+    }
+    if (frameLen >= FRAME_BUFFER_SIZE) {
+        sendNack(NACK_OVERFLOW);
+        frameState = FRAME_HUNT;
+        return;
+    }
+    frame[frameLen++] = b;
+    frameCrc = crc8Update(frameCrc, b);        // Zero over data + CRC when intact.
+}
+
+// A frame with a good CRC: check its sequence number, then run the packet.
+// Frames behind a missing one are dropped (the Pi resends from the missing
+// one on), and repeats of frames already run are ignored.
+void RemoteControl::acceptFrame() {
+    uint8_t seq  = frame[0];
+    uint8_t type = frame[1];
+
+    badRun    = 0;
+    baudTrial = false;                         // The new rate works.
+
+    if (type == LINK_RESET_MARKER) {           // Pi (re)connected: count from here.
+        rxSeq           = seq + 1;
+        rxSeqValid      = true;
+        nackOutstanding = false;
+        return;
+    }
+    if (!rxSeqValid) {                         // First frame since power-up.
+        rxSeq      = seq;
+        rxSeqValid = true;
+    }
+    int8_t ahead = (int8_t)(seq - rxSeq);
+    if (ahead < 0) return;                     // Duplicate of a frame already run.
+    if (ahead > 0) {
+        sendNack(NACK_GAP);
+        return;
+    }
+    ++rxSeq;
+    nackOutstanding = false;
+    processPacket(type, frame + 2, frameLen - FRAME_OVERHEAD);
+}
+
+// Ask the Pi to resend from rxSeq on. While a NACK is unanswered it is only
+// repeated every NACK_REPEAT_US, so a burst of dropped frames costs one line.
+void RemoteControl::sendNack(uint8_t reason) {
+    ++badFrames;
+    telemetry.log(TEL_NACK, rxSeq, reason, 0, badFrames);
+    // Gaps follow from one damaged frame, so only damage counts towards
+    // giving up a fast rate that is not reliable on this cable.
+    if (reason != NACK_GAP && ++badRun >= BAUD_FALLBACK_BAD_FRAMES
+     && linkBaud != BASE_BAUD) {
+        baudTrial = false;
+        setLinkBaud(BASE_BAUD);
+        return;
+    }
+    if (!rxSeqValid) return;                   // Nothing to ask for yet.
+    uint32_t now = micros();
+    if (nackOutstanding && now - lastNackTime < NACK_REPEAT_US) return;
+    nackOutstanding = true;
+    lastNackTime    = now;
+    Serial.print("NACK:");
+    Serial.println(rxSeq);
+}
+
+// Run one packet from a verified frame. A payload of the wrong size for its
+// type is a protocol mismatch rather than line noise, so it is reported and
+// skipped instead of NACKed.
+void RemoteControl::processPacket(uint8_t type, const uint8_t* p, uint8_t len) {
+    switch (type) {
+
+    // —— RESET packet ——
+    case RESET_MARKER:
+        if (len != MAX_RESET_SERVOS * 2) break;
+        for (int idx = 0; idx < MAX_RESET_SERVOS; ++idx) {
+            int16_t angle = (int16_t)(((uint16_t)p[2 * idx] << 8) | p[2 * idx + 1]);
+            stageServoAngle(idx, angle);  // Queue servo move to neutral
+            poses[0][idx] = (uint8_t)constrain(angle, 0, MAX_SERVO_ANGLE);
+        }
+        forceServoRefresh();   // Rewrite neutral even where the shadow has it: a
+                               // write the board missed would otherwise last.
+        commitStagedServos();  // Move every servo in one burst per board.
+        telemetry.log(TEL_RESET);
+        Serial.println("RESET_DONE");
+        return;
+
+    // —— BATCH packet ——
+    case BATCH_MARKER:
+        handleBatch(p, len);
+        return;
+
+    // —— PICK command packet ——
+    case COMMAND_MARKER: {
+        if (len != COMMAND_PAYLOAD_SIZE) break;
+        Command cmd;
+        cmd.targetIndex   = p[0];               // 1 byte: servo index
+        cmd.angle         = p[1];               // 1 byte: angle in degrees (0-180)
+        cmd.relativeDelay = readUint32LE(p + 2); // 4 bytes: delay in µs
+        if (commandQueue.push(cmd)) {    // Buffer the pick command.
+            ++acceptedCount;
+            telemetry.log(TEL_RECEIVED, cmd.targetIndex, cmd.angle,
+                          cmd.relativeDelay, 0, commandQueue.size());
+        } else {
+            Serial.println("ERROR: command buffer full");
+        }
+        return;
+    }
+
+    // —— END‐OF‐SONG packet ——
+    case END_MARKER: {
+        if (len != END_PAYLOAD_SIZE) break;
+        // Buffer special command to signal song end (targetIndex=255).
+        Command cmd;
+        cmd.targetIndex   = 255;      // Special sentinel index.
+        cmd.angle         = 0;        // Angle unused for end marker.
+        cmd.relativeDelay = readUint32LE(p);  // Delay after sync time.
+        if (commandQueue.push(cmd)) {
+            ++acceptedCount;
+        } else {
+            Serial.println("ERROR: command buffer full");
+        }
+        return;
+    }
+
+    // —— GET_TIME packet ——
+    case GET_TIME_MARKER: {
+        if (len != GET_TIME_PAYLOAD_SIZE) break;
+        uint32_t t = micros();       // Sample as close to arrival as possible.
+        uint8_t reply[6] = {
+            TIME_REPLY_MARKER, p[0],
+            (uint8_t)t, (uint8_t)(t >> 8), (uint8_t)(t >> 16), (uint8_t)(t >> 24)
+        };
+        Serial.write(reply, sizeof(reply));  // Binary reply, little-endian.
+        return;
+    }
+
+    // —— CLOCK_ADJ packet ——
+    case CLOCK_ADJ_MARKER:
+        if (len != CLOCK_ADJ_PAYLOAD_SIZE) break;
+        adjustClock(readUint32LE(p), (int32_t)readUint32LE(p + 4),
+                    (int32_t)readUint32LE(p + 8));
+        return;
+
+    // —— CALIBRATE packet ——
+    case CALIBRATE_MARKER:
+        if (len != CALIBRATE_PAYLOAD_SIZE) break;
+        if (!setServoPulseRange(p[0], readUint16LE(p + 1), readUint16LE(p + 3))) {
+            Serial.println("ERROR: bad calibration");
+        }
+        return;
+
+    // —— PULSE packet ——
+    case PULSE_MARKER:
+        if (len != PULSE_PAYLOAD_SIZE) break;
+        stageServoPulse(p[0], readUint16LE(p + 1));
+        commitStagedServos();        // Raw counts move at once (calibration jog).
+        return;
+
+    // —— POSE_DEFINE packet ——
+    case POSE_DEFINE_MARKER:
+        if (len != POSE_DEFINE_SIZE) break;
+        if (p[0] < MAX_POSES) {
+            memcpy(poses[p[0]], p + 1, MAX_SERVOS);
+        } else {
+            Serial.println("ERROR: bad pose id");
+        }
+        return;
+
+    // —— SYNC packet ——
+    case SYNC_MARKER: {
+        if (len != SYNC_PAYLOAD_SIZE) break;
+        if (p[0] != SYNC_TYPE) {
+            Serial.println("ERROR: unexpected sync type");  // Keep running; Pi may resend.
+            return;
+        }
+        uint32_t t = ((uint32_t)p[1] << 24) | ((uint32_t)p[2] << 16)
+                   | ((uint32_t)p[3] << 8)  |  (uint32_t)p[4];  // Big-endian startTime.
+        syncStartTime = t;                   // Record base time for commands.
+        adjustClock(t, 0, clockRatePpm);     // Song time 0 at t, keep drift rate.
+        syncReceived  = true;                // Enable command execution.
+        storePlaying  = false;               // The Pi streams this song.
+        commandQueue.clear();                // Clear any old commands.
+        acceptedCount = 0;                   // Restart credit accounting.
+        telemetry.log(TEL_SYNC, 0, 0, t);   // Log sync timestamp.
+        Serial.println("SYNCED");            // Later FREE reports use this epoch.
+        reportCredit();                      // Grant the Pi an empty queue.
+        return;
+    }
+
+    // —— Stored song packets ——
+    case STORE_BEGIN_MARKER:
+    case STORE_DATA_MARKER:
+    case STORE_END_MARKER:
+        handleStore(type, p, len);
+        return;
+
+    case STORE_QUERY_MARKER:
+        reportStored();
+        return;
+
+    case PLAY_STORED_MARKER:
+        if (len != PLAY_STORED_SIZE) break;
+        playStored(readUint32LE(p), readUint32LE(p + 4));
+        return;
+
+    // —— CAPS packet ——
+    case CAPS_MARKER:
+        Serial.print("CAPS:");
+        for (uint8_t i = 0; i < sizeof(supportedBauds) / sizeof(supportedBauds[0]); ++i) {
+            if (i) Serial.print(" ");
+            Serial.print(supportedBauds[i]);
+        }
+        Serial.println();
+        return;
+
+    // —— BAUD packet ——
+    case BAUD_MARKER: {
+        if (len != BAUD_PAYLOAD_SIZE) break;
+        uint32_t baud = readUint32LE(p);
+        if (!baudSupported(baud)) {
+            Serial.println("ERROR: bad baud");
+            return;
+        }
+        Serial.print("BAUD:");               // Still at the old rate.
+        Serial.println(baud);
+        trialPrevBaud = linkBaud;
+        setLinkBaud(baud);
+        baudTrial  = true;                   // Until a good frame arrives.
+        trialStart = millis();
+        return;
+    }
+
+    // —— STATS packet ——
+    case STATS_MARKER:
+        if (len != STATS_PAYLOAD_SIZE) break;
+        reportStats(p[0] & STATS_CLEAR);
+        return;
+
+    // —— ECHO packet ——
+    case ECHO_MARKER:
+        Serial.print("ECHO:");
+        for (uint8_t i = 0; i < len; ++i) {
+            if (p[i] < 0x10) Serial.print("0");
+            Serial.print(p[i], HEX);
+        }
+        Serial.println();
+        return;
+
+    default:
+        break;
+    }
+    Serial.print("ERROR: bad packet 0x");
+    Serial.println(type, HEX);
+}
+
+// Buffer every record of a BATCH packet, or none. Payload: count(1),
+// baseDelay(4, little-endian), then count records of target(1), angle(1),
+// offset(3, little-endian µs after baseDelay).
+void RemoteControl::handleBatch(const uint8_t* p, uint8_t len) {
+    uint8_t count = len > 0 ? p[0] : 0;
+    if (count == 0 || count > MAX_BATCH_RECORDS
+     || len != BATCH_FIXED_LEN + count * BATCH_RECORD_SIZE) {
+        Serial.println("ERROR: bad batch length");
+        return;
+    }
+    if (commandQueue.capacity() - commandQueue.size() < count) {
+        Serial.println("ERROR: command buffer full");
+        return;  // Reject the whole batch so the Pi can resend it intact.
+    }
+
+    uint32_t base = readUint32LE(p + 1);
+    const uint8_t* rec = p + BATCH_FIXED_LEN;
+    for (uint8_t i = 0; i < count; ++i, rec += BATCH_RECORD_SIZE) {
+        Command cmd;
+        cmd.targetIndex   = rec[0];
+        cmd.angle         = rec[1];
+        cmd.relativeDelay = base + ((uint32_t)rec[2]
+                                 | ((uint32_t)rec[3] << 8)
+                                 | ((uint32_t)rec[4] << 16));
+        commandQueue.push(cmd);
+    }
+    acceptedCount += count;
+    telemetry.log(TEL_BATCH, count, 0, base, 0, commandQueue.size());
+}
+
+// Execute buffered commands whose scheduled time has been reached since sync.
+// The queue keeps the earliest command at its head, so only the head is
+// inspected; everything behind it is due later. All moves that are due in
+// the same pass are staged and then written together, one burst per board.
+void RemoteControl::update() {
+    if (!syncReceived) return;  // Skip if no sync received.
+
+    uint32_t t0  = micros();
+    int32_t  now = songTime(t0);       // Drift-corrected µs since sync.
+    bool songDone = false;
+    bool ran      = false;
+    while (!songDone && !commandQueue.empty()) {
+        int32_t execTime = (int32_t)commandQueue.peek().relativeDelay;
+        if (now - execTime < 0) break;  // Head not due yet, so nothing else is.
+
+        Command cmd;
+        commandQueue.pop(cmd);  // Remove the command we are about to run.
+        ++freedSinceReport;
+        dispatchArmed = false;  // The timer was set for this one.
+        ran = true;
+
+        // is this our end‐of‐song marker?
+        if (cmd.targetIndex == 255) {
+            songDone = true;
+            telemetry.log(TEL_DONE, 0, 0, now);
+            reportI2C();  // Bus totals for the song.
+        }
+        else if (cmd.targetIndex >= POSE_TARGET_BASE) {
+            // pose trigger: every servo in the pose moves in this burst
+            telemetry.log(TEL_EXECUTED, cmd.targetIndex, 0,
+                          cmd.relativeDelay, now - (int32_t)cmd.relativeDelay,
+                          commandQueue.size());
+            recordLateness(now - (int32_t)cmd.relativeDelay);
+            stagePose(cmd.targetIndex - POSE_TARGET_BASE);
+        }
+        else {
+            // execute pick; lateness is measured against this pass's clock
+            telemetry.log(TEL_EXECUTED, cmd.targetIndex, cmd.angle,
+                          cmd.relativeDelay, now - (int32_t)cmd.relativeDelay,
+                          commandQueue.size());
+            recordLateness(now - (int32_t)cmd.relativeDelay);
+            stageServoAngle(cmd.targetIndex, cmd.angle);  // Queue servo motion.
+        }
+    }
+    commitStagedServos();  // Trigger every due servo motion at once.
+    if (ran) {
+        uint16_t took = saturate16(micros() - t0);
+        if (took > timing.burstMax) timing.burstMax = took;
+    }
+
+    // Hand freed slots back to the Pi in steps rather than one line per move.
+    // A stored song refills the queue itself and needs no credit.
+    if (!storePlaying && (freedSinceReport >= CREDIT_REPORT_STEP
+     || (freedSinceReport > 0 && commandQueue.empty()))) {
+        reportCredit();
+    }
+
+    if (songDone) {
+        // print DONE and stop accepting further commands
+        Serial.println("DONE");      // Signal end of song.
+        syncReceived = false;         // Stop further execution.
+        storePlaying = false;
+    }
+}
+
+// Upload packets. Each one is answered, and the Pi sends the next only then:
+// EEPROM writes block for milliseconds, longer than the serial buffer lasts
+// at full rate. Nothing is stored while a song is playing.
+void RemoteControl::handleStore(uint8_t type, const uint8_t* p, uint8_t len) {
+    if (syncReceived) {
+        Serial.println("STORE:BUSY");
+        return;
+    }
+    switch (type) {
+    case STORE_BEGIN_MARKER:
+        if (len != STORE_BEGIN_SIZE) break;
+        if (!songStoreBegin(readUint32LE(p), readUint16LE(p + 4), readUint32LE(p + 6))) {
+            Serial.print("STORE:FULL ");
+            Serial.println(songStoreCapacity());
+            return;
+        }
+        Serial.println("STORE:0");           // Next record expected.
+        return;
+
+    case STORE_DATA_MARKER: {
+        uint8_t n = (len - STORE_DATA_FIXED_LEN) / SONG_STORE_RECORD_SIZE;
+        if (len < STORE_DATA_FIXED_LEN || n == 0 || n > MAX_BATCH_RECORDS
+         || len != STORE_DATA_FIXED_LEN + n * SONG_STORE_RECORD_SIZE) break;
+        uint16_t index = readUint16LE(p);
+        if (!songStoreWrite(index, p + STORE_DATA_FIXED_LEN, n)) {
+            Serial.println("STORE:BAD");
+            return;
+        }
+        Serial.print("STORE:");
+        Serial.println(index + n);
+        return;
+    }
+
+    case STORE_END_MARKER:
+        if (len != STORE_END_SIZE) break;
+        if (!songStoreFinish(p[0])) {
+            Serial.println("STORED:BAD");   // Read back wrong: nothing valid stored.
+            return;
+        }
+        reportStored();
+        return;
+
+    default:
+        break;
+    }
+    Serial.println("STORE:BAD");
+}
+
+// "STORED:<id in hex> <count> <capacity>", with id "none" if nothing is stored.
+void RemoteControl::reportStored() {
+    const SongStoreInfo& s = songStoreInfo();
+    Serial.print("STORED:");
+    if (s.valid) Serial.print(s.id, HEX);
+    else         Serial.print("none");
+    Serial.print(" ");
+    Serial.print(s.valid ? s.count : 0);
+    Serial.print(" ");
+    Serial.println(songStoreCapacity());
+}
+
+// Start the stored song like a SYNC: song time from is reached at local
+// micros() start. Everything before from is skipped, but the last position
+// each servo had there is written at once, so the frets are in place.
+void RemoteControl::playStored(uint32_t start, uint32_t from) {
+    if (!songStoreInfo().valid) {
+        Serial.println("PLAYING:none");
+        return;
+    }
+    syncStartTime = start;
+    adjustClock(start, (int32_t)from, clockRatePpm);
+    syncReceived   = true;
+    commandQueue.clear();
+    acceptedCount  = 0;
+    storePlaying   = true;
+    storeEndQueued = false;
+    storeNext      = 0;
+    storeTime      = 0;
+    storeFrom      = from;
+    storeCatchUp   = from > 0;
+    memset(catchUp, POSE_UNCHANGED, sizeof(catchUp));
+    telemetry.log(TEL_SYNC, 0, 0, start);
+    Serial.print("PLAYING:");
+    Serial.println(songStoreInfo().count);
+}
+
+// Read stored records into the queue while it has room, a few per pass so
+// the loop keeps its timing, then the END marker after the last one.
+void RemoteControl::refillFromStore() {
+    if (!storePlaying || storeEndQueued) return;
+    const SongStoreInfo& s = songStoreInfo();
+    uint8_t work = 0;  // Skipped records cost 1, queued ones more.
+    while (!commandQueue.full() && work < STORE_SKIP_PER_PASS && !dispatchPending()) {
+        if (storeNext == s.count) {
+            Command end;
+            end.targetIndex   = 255;
+            end.angle         = 0;
+            end.relativeDelay = s.endTime;
+            commandQueue.push(end);
+            storeEndQueued = true;
+        }
+        Command cmd;
+        if (!storeEndQueued) {
+            uint32_t delta;
+            songStoreRead(storeNext, cmd.targetIndex, cmd.angle, delta);
+            storeTime += delta;
+            ++storeNext;
+            if (storeTime < storeFrom) {
+                // Before the seek point: only remember where it leaves the servo.
+                if (cmd.targetIndex < MAX_SERVOS) {
+                    catchUp[cmd.targetIndex] = cmd.angle;
+                } else if (cmd.targetIndex >= POSE_TARGET_BASE
+                        && cmd.targetIndex - POSE_TARGET_BASE < MAX_POSES) {
+                    const uint8_t* pose = poses[cmd.targetIndex - POSE_TARGET_BASE];
+                    for (uint8_t i = 0; i < MAX_SERVOS; ++i) {
+                        if (pose[i] != POSE_UNCHANGED) catchUp[i] = pose[i];
+                    }
+                }
+                ++work;
+                continue;
+            }
+        }
+        if (storeCatchUp) {
+            // A pick may sound once as it goes to its side.
+            for (uint8_t i = 0; i < MAX_SERVOS; ++i) {
+                if (catchUp[i] != POSE_UNCHANGED) stageServoAngle(i, catchUp[i]);
+            }
+            commitStagedServos();
+            storeCatchUp = false;
+        }
+        if (storeEndQueued) return;
+        cmd.relativeDelay = storeTime;
+        commandQueue.push(cmd);
+        work += STORE_SKIP_PER_PASS / STORE_REFILL_PER_PASS;
+    }
+}
+
+// Log the I2C transmit queue totals.
+void RemoteControl::reportI2C() {
+    const I2CQueueStats& s = i2cQueueStats();
+    i2cRefusedLogged = s.refused;
+    telemetry.log(TEL_I2C, s.maxDepth, s.stalls > 255 ? 255 : s.stalls, s.sent, s.refused);
+    const ServoWriteStats& w = servoWriteStats();
+    uint32_t staged = w.saved + w.written;
+    telemetry.log(TEL_WRITES, 0, 0, w.saved,
+                  staged ? (int32_t)((uint64_t)w.saved * 1000 / staged) : 0);
+}
+
+// Count one executed command in the lateness histogram.
+void RemoteControl::recordLateness(int32_t late) {
+    uint32_t us = late > 0 ? (uint32_t)late : 0;
+    uint8_t  b  = 0;
+    for (uint32_t edge = LATENESS_BUCKET0_US; us >= edge && b < LATENESS_BUCKETS - 1; edge <<= 1) ++b;
+    if (timing.lateness[b] < 0xFFFF) ++timing.lateness[b];
+    if (saturate16(us) > timing.lateMax) timing.lateMax = saturate16(us);
+}
+
+void RemoteControl::clearTimingStats() {
+    memset(&timing, 0, sizeof(timing));
+    timing.loopMin = 0xFFFF;
+}
+
+// Binary reply, little-endian: marker(1), lateness[LATENESS_BUCKETS](2 each),
+// lateMax(2), loopMin(2), loopMax(2), parseMax(2), burstMax(2), I2C sent(2),
+// I2C maxMicros(2), I2C busyMicros(4), rxFull(2), badFrames(2), queueHigh(1).
+// The counters are read (and cleared) now; the reply goes out from handle()
+// once the TX buffer can take it whole, so it never blocks.
+void RemoteControl::reportStats(bool clear) {
+    const I2CQueueStats& i2c = i2cQueueStats();
+    uint8_t* p = statsReply;
+    *p++ = STATS_REPLY_MARKER;
+    for (uint8_t i = 0; i < LATENESS_BUCKETS; ++i) p = putUint16LE(p, timing.lateness[i]);
+    p = putUint16LE(p, timing.lateMax);
+    p = putUint16LE(p, timing.loopMin);
+    p = putUint16LE(p, timing.loopMax);
+    p = putUint16LE(p, timing.parseMax);
+    p = putUint16LE(p, timing.burstMax);
+    p = putUint16LE(p, i2c.sent);
+    p = putUint16LE(p, i2c.maxMicros);
+    p = putUint16LE(p, (uint16_t)i2c.busyMicros);
+    p = putUint16LE(p, (uint16_t)(i2c.busyMicros >> 16));
+    p = putUint16LE(p, timing.rxFull);
+    p = putUint16LE(p, badFrames);
+    *p++ = timing.queueHigh;
+    statsPending = true;
+    if (clear) {
+        clearTimingStats();
+        i2cQueueClearPeaks();
+    }
+    sendStats();
+}
+
+// Write the pending STATS reply if the TX buffer has room for all of it.
+void RemoteControl::sendStats() {
+    if (!statsPending || Serial.availableForWrite() < STATS_REPLY_SIZE) return;
+    Serial.write(statsReply, STATS_REPLY_SIZE);
+    statsPending = false;
+}
+
+// Stage every servo a pose sets; unknown ids and POSE_UNCHANGED entries are
+// skipped, so a pose can cover any subset of the servos.
+void RemoteControl::stagePose(uint8_t id) {
+    if (id >= MAX_POSES) return;
+    for (uint8_t i = 0; i < MAX_SERVOS; ++i) {
+        if (poses[id][i] != POSE_UNCHANGED) stageServoAngle(i, poses[id][i]);
+    }
+}
+
+// Arm the dispatch timer for the command at the head of the queue. Nothing is
+// reprogrammed while the timer already targets that command; a new earlier
+// command, a clock adjustment or an early wake-up (waits longer than one
+// timer period) re-arm it from the current song time.
+void RemoteControl::scheduleDispatch() {
+    if (!syncReceived || commandQueue.empty()) {
+        if (dispatchArmed) disarmDispatchTimer();
+        dispatchArmed = false;
+        return;
+    }
+    const Command& head = commandQueue.peek();
+    if (dispatchArmed && head.seq == armedSeq && !dispatchPending()) return;
+
+    int32_t wait = (int32_t)head.relativeDelay - songTime(micros());
+    armDispatchTimer(wait > 0 ? (uint32_t)wait : 0);
+    dispatchArmed = true;
+    armedSeq      = head.seq;
+}
+
+// Reopen the serial port at another rate once everything queued for the Pi
+// has gone out. Bytes caught mid-switch are garbage, so the receiver hunts
+// for the next flag; frames lost that way are NACKed as usual.
+void RemoteControl::setLinkBaud(uint32_t baud) {
+    Serial.flush();
+    Serial.end();
+    Serial.begin(baud);
+    linkBaud   = baud;
+    frameState = FRAME_HUNT;
+    badRun     = 0;
+    telemetry.log(TEL_BAUD, 0, 0, baud);
+}
+
+// Return to the previous rate if the Pi never got through at the new one.
+void RemoteControl::checkBaudTrial() {
+    if (baudTrial && millis() - trialStart > BAUD_TRIAL_MS) {
+        baudTrial = false;
+        setLinkBaud(trialPrevBaud);
+    }
+}
+
+// Drop every pending command and move every servo to the neutral pose in one
+// burst. A partly received frame is abandoned too; the Pi never splits a
+// frame with a STOP burst, so it can only be noise.
+void RemoteControl::emergencyStop() {
+    frameState = FRAME_HUNT;  // Resume at the next flag.
+    stopRun = STOP_RUN_HANDLED;
+    commandQueue.clear();
+    syncReceived = false;
+    storePlaying = false;
+    disarmDispatchTimer();
+    dispatchArmed = false;
+    i2cQueueClear();  // Moves not yet on the bus would only be undone.
+    invalidateServoShadow();  // Dropped bursts: rewrite neutral everywhere.
+    stagePose(0);
+    commitStagedServos();
+    Serial.println("STOPPED");
+}
+
+// Re-anchor the song clock: at local micros() refLocal the song time is
+// refSong µs, and from there it runs ratePpm parts-per-million faster (or
+// slower, if negative) than micros(). The Pi computes these from its drift
+// estimate.
+void RemoteControl::adjustClock(uint32_t refLocal, int32_t refSong, int32_t ratePpm) {
+    if (ratePpm >  MAX_CLOCK_RATE_PPM) ratePpm =  MAX_CLOCK_RATE_PPM;
+    if (ratePpm < -MAX_CLOCK_RATE_PPM) ratePpm = -MAX_CLOCK_RATE_PPM;
+    clockRefLocal   = refLocal;
+    clockRefSong    = refSong;
+    clockRatePpm    = ratePpm;
+    clockCorrection = 0;
+    clockFracAcc    = 0;
+    clockLastLocal  = refLocal;  // Correction accrues from the reference on.
+    dispatchArmed   = false;     // Deadlines moved: re-arm from the new clock.
+    telemetry.log(TEL_CLOCK_ADJ, 0, 0, (uint32_t)refSong, ratePpm);
+}
+
+// Song time in µs for a local micros() value: time since the clock reference
+// plus the drift correction accumulated since then. Negative before the
+// reference (e.g. during the sync delay). Both micros() and song time are
+// compared by signed 32-bit difference, so the clock is unaffected by the
+// micros() rollover every ~71 minutes; a song may last up to ~35 minutes.
+int32_t RemoteControl::songTime(uint32_t now) {
+    int32_t step = (int32_t)(now - clockLastLocal);
+    if (step > 0) {
+        clockLastLocal = now;
+        if (clockRatePpm != 0) {
+            // 64-bit product: a long pass between calls at a large rate
+            // would overflow 32 bits.
+            int64_t acc = clockFracAcc + (int64_t)step * clockRatePpm;
+            if (acc >= 1000000L || acc <= -1000000L) {
+                int32_t whole = (int32_t)(acc / 1000000L);
+                clockCorrection += whole;
+                acc             -= (int64_t)whole * 1000000L;
+            }
+            clockFracAcc = (int32_t)acc;
+        }
+    }
+    return clockRefSong + (int32_t)(now - clockRefLocal) + clockCorrection;
+}
+
+// Tell the Pi how many queue slots are free and how many commands have been
+// accepted since SYNC. Commands the Pi sent after this count was taken are
+// still in flight, so the Pi subtracts (sent − accepted) from the free count.
+void RemoteControl::reportCredit() {
+    freedSinceReport = 0;
+    Serial.print("FREE:");
+    Serial.print(commandQueue.capacity() - commandQueue.size());
+    Serial.print(" ");
+    Serial.println(acceptedCount);
+}
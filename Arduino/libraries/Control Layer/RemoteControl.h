@@ -1,59 +1,199 @@
-#ifndef REMOTE_CONTROL_H
-#define REMOTE_CONTROL_H
-
-#include <Arduino.h>
-#include "ServoControl.h"
-
-/**
- * @brief RemoteControl handles incoming serial “PICK” commands,
- *        buffers them, and executes each servo move at the correct time.
- */
-class RemoteControl {
-public:
-    // maximum number of buffered commands
-    static const int MAX_COMMANDS = 1;
-
-    RemoteControl();
-
-    /**
-     * @brief Initialise I2C boards and internal state.
-     * @param i2cAddrs   Array of PCA9685 I²C addresses (e.g. {0x40,0x41})
-     * @param addrCount  Number of entries in i2cAddrs (≤ MAX_BOARDS)
-     * @param debug      If true, enable verbose serial logging
-     */
-    void begin(const uint8_t i2cAddrs[], int addrCount, bool debug=false);
-
-    /**
-     * @brief Map a logical servo index to a specific board & channel.
-     * @param boardIndex  PCA9685 board (0…numBoards−1)
-     * @param channel     channel on that board (0…15)
-     * @param servoIndex  logical index (0…MAX_SERVOS−1)
-     */
-    void addServo(uint8_t boardIndex, uint8_t channel, uint8_t servoIndex);
-
-    /**
-     * @brief Call once per loop to process incoming data and execute due picks.
-     */
-    void handle();
-
-private:
-    // internal representation of one PICK command
-    struct Command {
-        uint8_t  targetIndex;     // 1 byte: servo index
-        uint8_t  angle;           // 1 byte: angle in degrees (0–180)
-        uint32_t relativeDelay;   // 4 bytes: delay in ms from sync (0–~49 days)
-    };                            // Total: 6 bytes
-
-    void processSerialCommands();
-    void parseSerialData();
-    void update();  
-    void errorHandler(const char* msg);
-
-    Command      commandBuffer[MAX_COMMANDS];
-    int          commandCount;
-    bool         syncReceived;
-    unsigned long syncStartTime;
-    bool         debugEnabled;
-};
-
-#endif  // REMOTE_CONTROL_H
+#ifndef REMOTE_CONTROL_H
+#define REMOTE_CONTROL_H
+
+#include <Arduino.h>
+#include "ServoControl.h"
+#include "CommandQueue.h"
+#include "DispatchTimer.h"
+#include "Telemetry.h"
+#include "SongStore.h"
+
+// Lateness histogram: bucket 0 holds commands run under LATENESS_BUCKET0_US
+// past their deadline, each later bucket twice the span of the one before,
+// and the last everything beyond.
+#define LATENESS_BUCKETS     8
+#define LATENESS_BUCKET0_US  64
+
+// Bytes in the binary STATS reply (see RemoteControl::reportStats()).
+#define STATS_REPLY_SIZE     40
+
+// Timing counters, answered to a STATS packet. Times are micros() (4 µs
+// resolution at 16 MHz), saturated to 16 bits; counts run from start-up or
+// the last STATS packet that asked for a clear.
+struct TimingStats {
+    uint16_t lateness[LATENESS_BUCKETS];  // Commands run, by µs past their deadline.
+    uint16_t lateMax;    // Most µs a command ran past its deadline.
+    uint16_t loopMin;    // Shortest and longest time between handle() calls.
+    uint16_t loopMax;
+    uint16_t parseMax;   // Longest parseSerialData() pass.
+    uint16_t burstMax;   // Longest update() pass that ran commands, writes included.
+    uint16_t rxFull;     // Passes that found the serial RX buffer full (bytes may be lost).
+    uint8_t  queueHigh;  // Most commands buffered at once.
+};
+
+/**
+ * @brief RemoteControl handles incoming serial “PICK” commands,
+ *        buffers them, and executes each servo move at the correct time.
+ *
+ * Packets from the Pi arrive in frames: 0x7E, then seq, type, payload and a
+ * CRC-8, escaped so that 0x7E, 0x7D and 0xEE never occur inside, then 0x7E.
+ * A damaged frame is dropped at the next 0x7E and answered with
+ * "NACK:<seq>"; frames after it are dropped until the Pi resends from seq.
+ * A burst of 0xEE bytes (STOP) stays outside the framing.
+ *
+ * The link starts at BASE_BAUD. The Pi asks for the supported rates (CAPS),
+ * requests one (BAUD) and proves it with an ECHO; a rate that sees no good
+ * frame within BAUD_TRIAL_MS, or too many damaged frames later, is dropped
+ * again for the previous or base rate.
+ *
+ * A song can also be uploaded once into the SongStore (STORE_BEGIN, DATA,
+ * END) and played from there (PLAY_STORED): handle() then refills the
+ * command queue from the store itself, and the link carries nothing but
+ * the start, clock corrections and a STOP.
+ *
+ * A STATS packet is answered with the TimingStats, the I2C queue times and
+ * the damaged-frame count in one binary reply (STATS_REPLY_MARKER). The
+ * reply is kept until the TX buffer has room for all of it, ahead of any
+ * telemetry, so it never waits mid-song.
+ */
+class RemoteControl {
+public:
+    // maximum number of buffered commands
+    static const int MAX_COMMANDS = COMMAND_QUEUE_CAPACITY;
+
+    // maximum records in one BATCH frame; the decoded frame (seq, type,
+    // 5 + 5·N payload bytes and CRC) must fit in FRAME_BUFFER_SIZE
+    static const uint8_t MAX_BATCH_RECORDS = 11;
+
+    // Pose registers: whole-instrument servo positions uploaded by the Pi
+    // once, then triggered by a command whose target is POSE_TARGET_BASE + id.
+    // Pose 0 is the neutral pose, also written by every RESET packet.
+    static const uint8_t MAX_POSES        = 16;
+    static const uint8_t POSE_TARGET_BASE = 0x80;
+    static const uint8_t POSE_UNCHANGED   = 0xFF;  // Angle that leaves a servo alone.
+
+    // largest decoded frame: seq(1) + type(1) + payload + crc(1)
+    static const uint8_t FRAME_BUFFER_SIZE = 64;
+
+    // Stored records read into the queue per loop pass; records skipped
+    // before a seek point cost less and are read STORE_SKIP_PER_PASS at a time.
+    static const uint8_t STORE_REFILL_PER_PASS = 4;
+    static const uint8_t STORE_SKIP_PER_PASS   = 32;
+
+    // Serial rate the sketch opens the port at, and the one every link
+    // falls back to; the Pi may negotiate a faster one (see setLinkBaud()).
+    static const uint32_t BASE_BAUD = 115200;
+
+    RemoteControl();
+
+    /**
+     * @brief Initialise I2C boards and internal state.
+     * @param i2cAddrs   Array of PCA9685 I²C addresses (e.g. {0x40,0x41})
+     * @param addrCount  Number of entries in i2cAddrs (≤ MAX_BOARDS)
+     * @param debug      If true, send binary telemetry records (see Telemetry.h)
+     * @param i2cClock   Requested I²C bus clock in Hz (I2C_CLOCK_STANDARD,
+     *                   I2C_CLOCK_FAST or I2C_CLOCK_FAST_PLUS); falls back to
+     *                   a slower speed if any board stops responding
+     */
+    void begin(const uint8_t i2cAddrs[], int addrCount, bool debug=false,
+               uint32_t i2cClock=I2C_CLOCK_STANDARD);
+
+    /**
+     * @brief Map a logical servo index to a specific board & channel.
+     * @param boardIndex  PCA9685 board (0…numBoards−1)
+     * @param channel     channel on that board (0…15)
+     * @param servoIndex  logical index (0…MAX_SERVOS−1)
+     */
+    void addServo(uint8_t boardIndex, uint8_t channel, uint8_t servoIndex);
+
+    /**
+     * @brief Map servos 0…count−1 from a table of servoSlot(board, channel).
+     * @param slots  One slot per servo, or SERVO_UNMAPPED
+     * @param count  Entries in slots (≤ MAX_SERVOS)
+     */
+    void addServos(const uint8_t slots[], uint8_t count);
+
+    /**
+     * @brief Call once per loop to process incoming data and execute due picks.
+     */
+    void handle();
+
+private:
+    void processSerialCommands();
+    void parseSerialData();
+    void feedFrameByte(uint8_t b);
+    void acceptFrame();
+    void processPacket(uint8_t type, const uint8_t* p, uint8_t len);
+    void sendNack(uint8_t reason);
+    void setLinkBaud(uint32_t baud);
+    void checkBaudTrial();
+    void emergencyStop();
+    void handleBatch(const uint8_t* p, uint8_t len);
+    void handleStore(uint8_t type, const uint8_t* p, uint8_t len);
+    void reportStored();
+    void playStored(uint32_t start, uint32_t from);
+    void refillFromStore();
+    void update();  
+    void scheduleDispatch();
+    void stagePose(uint8_t id);
+    void reportCredit();
+    void reportI2C();
+    void reportStats(bool clear);
+    void sendStats();
+    void recordLateness(int32_t late);
+    void clearTimingStats();
+    void adjustClock(uint32_t refLocal, int32_t refSong, int32_t ratePpm);
+    int32_t songTime(uint32_t now);
+
+    static const uint8_t STOP_RUN_HANDLED = 0xFF;  // stopRun after a STOP is applied.
+
+    // Frame receiver states (see feedFrameByte())
+    enum FrameState : uint8_t { FRAME_HUNT, FRAME_DATA, FRAME_ESCAPE };
+
+    CommandQueue<MAX_COMMANDS> commandQueue;  // Pending commands, earliest first.
+    uint8_t      frame[FRAME_BUFFER_SIZE];  // Frame being received, unescaped.
+    uint8_t      frameLen;         // Bytes in frame so far.
+    uint8_t      frameCrc;         // CRC-8 over those bytes.
+    FrameState   frameState;
+    uint8_t      rxSeq;            // Sequence number of the next frame expected.
+    bool         rxSeqValid;       // False until the first good frame sets rxSeq.
+    bool         nackOutstanding;  // A NACK for rxSeq was sent and not answered.
+    uint32_t     lastNackTime;     // micros() of that NACK.
+    uint16_t     badFrames;        // Frames dropped for CRC, length or gaps.
+    uint8_t      stopRun;          // Consecutive STOP bytes just received.
+    uint32_t     linkBaud;         // Current serial rate.
+    uint32_t     trialPrevBaud;    // Rate to return to if the trial fails.
+    uint32_t     trialStart;       // millis() when the trial rate was set.
+    bool         baudTrial;        // New rate set, no good frame received yet.
+    uint8_t      badRun;           // Damaged frames since the last good one.
+    uint16_t     i2cRefusedLogged; // I2C queue refusal count last sent as TEL_I2C.
+    uint16_t     acceptedCount;    // Commands buffered since SYNC (wraps at 65536).
+    uint8_t      freedSinceReport; // Slots freed since the last FREE report.
+    uint8_t      poses[MAX_POSES][MAX_SERVOS];  // Angle per servo, or POSE_UNCHANGED.
+    bool         dispatchArmed;    // Dispatch timer is set for the queue head.
+    uint16_t     armedSeq;         // seq of the command the timer is set for.
+    bool         syncReceived;
+    bool         storePlaying;     // Queue is fed from the SongStore, not the Pi.
+    bool         storeEndQueued;   // Every stored record and the END are queued.
+    uint16_t     storeNext;        // Next stored record to read.
+    uint32_t     storeTime;        // Song µs of the last record read.
+    uint32_t     storeFrom;        // Seek point: earlier records only set catchUp.
+    bool         storeCatchUp;     // catchUp holds positions still to be written.
+    uint8_t      catchUp[MAX_SERVOS];  // Angle per servo at the seek point, or POSE_UNCHANGED.
+    unsigned long syncStartTime;   // micros() at song time 0.
+    // Drift-corrected song clock (see songTime())
+    uint32_t     clockRefLocal;    // micros() at the clock reference point.
+    int32_t      clockRefSong;     // Song time (µs since sync) at that point.
+    int32_t      clockRatePpm;     // Song clock rate relative to micros().
+    int32_t      clockCorrection;  // Whole µs of drift accumulated so far.
+    int32_t      clockFracAcc;     // Sub-µs remainder, in µs·ppm.
+    uint32_t     clockLastLocal;   // micros() up to which drift is accumulated.
+    Telemetry    telemetry;        // Debug events, sent only when TX has room.
+    TimingStats  timing;           // Answered to STATS.
+    uint8_t      statsReply[STATS_REPLY_SIZE];  // Last STATS reply, while statsPending.
+    bool         statsPending;     // statsReply is waiting for TX space.
+    uint32_t     lastHandle;       // micros() at the previous handle() call.
+    bool         handleSeen;       // lastHandle is set.
+};
+
+#endif  // REMOTE_CONTROL_H
@@ -1,89 +1,376 @@
-#include "ServoControl.h"
-
-// Calculate pulse-length bounds once we know the PWM frequency:
-static int servomin;
-static int servomax;
-
-// Driver instances for each PCA9685
-Adafruit_PWMServoDriver pwmBoards[MAX_BOARDS];
-
-// Number of boards actually set up
-int numBoards = 0;
-
-// Mapping tables: logical → physical
-int servoBoard[MAX_SERVOS];
-int servoChannel[MAX_SERVOS];
-
-/**
- * @brief Initialise multiple PCA9685 boards at given I2C addresses.
- */
-void setupServoDrivers(const uint8_t i2cAddrs[], int count) {
-    // Determine how many boards we can support
-    numBoards = (count < MAX_BOARDS ? count : MAX_BOARDS);
-
-    // Compute servo pulse bounds
-    servomin = map(PWM_MIN_MICROSEC,
-                   0,
-                   1000000 / PWM_FREQUENCY,
-                   0,
-                   4096);
-    servomax = map(PWM_MAX_MICROSEC,
-                   0,
-                   1000000 / PWM_FREQUENCY,
-                   0,
-                   4096);
-
-    Wire.begin();
-
-    // Initialise each PCA9685
-    for (int i = 0; i < numBoards; i++) {
-        pwmBoards[i] = Adafruit_PWMServoDriver(i2cAddrs[i]);
-        pwmBoards[i].begin();
-        pwmBoards[i].setPWMFreq(PWM_FREQUENCY);
-    }
-
-    // Default mapping: servo N → board 0, channel N
-    for (int s = 0; s < MAX_SERVOS; s++) {
-        servoBoard[s]   = 0;
-        servoChannel[s] = (s < 16 ? s : 0);
-    }
-}
-
-/**
- * @brief Override the default mapping for one servo.
- */
-void setServoMapping(int servoIndex, int boardIndex, int channel) {
-    if (servoIndex >= 0 && servoIndex < MAX_SERVOS
-     && boardIndex  >= 0 && boardIndex  < numBoards
-     && channel     >= 0 && channel     < 16) {
-        servoBoard[servoIndex]   = boardIndex;
-        servoChannel[servoIndex] = channel;
-    }
-}
-
-/**
- * @brief Convert angle to pulse count.
- */
-int angleToPulse(int angle) {
-    // Clamp angle
-    if (angle < 0) angle = 0;
-    if (angle > MAX_SERVO_ANGLE) angle = MAX_SERVO_ANGLE;
-
-    return map(angle, 0, MAX_SERVO_ANGLE, servomin, servomax);
-}
-
-/**
- * @brief Move a logical servo to the specified angle.
- */
-void setServoAngle(int servoIndex, int angle) {
-    if (servoIndex < 0 || servoIndex >= MAX_SERVOS) return;
-
-    int b = servoBoard[servoIndex];
-    int c = servoChannel[servoIndex];
-    int pulse = angleToPulse(angle);
-
-    // Safety check
-    if (b < numBoards && c < 16) {
-        pwmBoards[b].setPWM(c, 0, pulse);
-    }
-}
+#include "ServoControl.h"
+
+// Calculate pulse-length bounds once we know the PWM frequency:
+static int servomin;
+static int servomax;
+
+// Driver instances for each PCA9685
+Adafruit_PWMServoDriver pwmBoards[MAX_BOARDS];
+
+// Number of boards actually set up
+int numBoards = 0;
+
+// I2C address of each board, for the transmit queue
+static uint8_t boardAddr[MAX_BOARDS];
+
+// Mapping table: logical → physical, one byte per servo
+uint8_t servoSlots[MAX_SERVOS];
+static_assert(MAX_BOARDS < 16, "a board index must fit a slot's high nibble, below SERVO_UNMAPPED");
+
+// Per-servo calibration: pulse = pulseMin + ((pulseScale * angle) >> 8), where
+// pulseScale is the count span per degree in 8.8 fixed point. Filled with the
+// default range at setup and replaced by setServoPulseRange().
+static uint16_t pulseMin[MAX_SERVOS];
+static uint16_t pulseScale[MAX_SERVOS];
+
+// Moves waiting for commitStagedServos(): pulse per channel, bit per channel
+static uint16_t stagedPulse[MAX_BOARDS][16];
+static uint16_t stagedMask[MAX_BOARDS];
+static uint8_t  stagedServo[MAX_BOARDS][16];  // Logical servo staged on each channel
+
+// Shadow of the last pulse committed per logical servo, like BusIO's
+// Adafruit_BusIO_Register::_cached: a move to the pulse a servo already has is
+// not written. SHADOW_UNKNOWN forces the next write.
+#define SHADOW_UNKNOWN 0xFFFF
+static uint16_t shadowPulse[MAX_SERVOS];
+static bool     forceNextCommit = false;
+static uint16_t shadowRefused   = 0;          // I2C queue refusals already seen
+static ServoWriteStats writeStats;
+
+// Bus speeds tried in order when raising the I2C clock
+static const uint32_t i2cClockSteps[] = {
+    I2C_CLOCK_FAST_PLUS, I2C_CLOCK_FAST, I2C_CLOCK_STANDARD
+};
+
+/**
+ * @brief Switch every board to the given clock and check they all respond.
+ *
+ * Each board must still ACK its address and read back the prescaler value
+ * written at the standard clock, so a marginal bus is caught before use.
+ */
+static bool trySetBusClock(uint32_t clk, const uint8_t prescale[]) {
+    for (int i = 0; i < numBoards; i++) {
+        if (!pwmBoards[i].setI2CSpeed(clk)) return false;
+    }
+    for (int i = 0; i < numBoards; i++) {
+        if (!pwmBoards[i].detected()
+         || pwmBoards[i].readPrescale() != prescale[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Initialise multiple PCA9685 boards at given I2C addresses.
+ */
+uint32_t setupServoDrivers(const uint8_t i2cAddrs[], int count,
+                           uint32_t i2cClock) {
+    // Determine how many boards we can support
+    numBoards = (count < MAX_BOARDS ? count : MAX_BOARDS);
+
+    // Compute servo pulse bounds
+    servomin = map(PWM_MIN_MICROSEC,
+                   0,
+                   1000000 / PWM_FREQUENCY,
+                   0,
+                   4096);
+    servomax = map(PWM_MAX_MICROSEC,
+                   0,
+                   1000000 / PWM_FREQUENCY,
+                   0,
+                   4096);
+
+    Wire.begin();
+
+    // Initialise each PCA9685
+    for (int i = 0; i < numBoards; i++) {
+        boardAddr[i] = i2cAddrs[i];
+        pwmBoards[i] = Adafruit_PWMServoDriver(i2cAddrs[i]);
+        pwmBoards[i].begin();
+        pwmBoards[i].setPWMFreq(PWM_FREQUENCY);
+        pwmBoards[i].setOutputChangeOnAck(false);  // Latch on STOP (see commit).
+        pwmBoards[i].setAllCall(USE_ALLCALL);
+    }
+
+    // Raise the bus clock, stepping down until every board answers
+    uint8_t prescale[MAX_BOARDS];
+    for (int i = 0; i < numBoards; i++) {
+        prescale[i] = pwmBoards[i].readPrescale();
+    }
+    uint32_t busClock = I2C_CLOCK_STANDARD;
+    for (size_t k = 0; k < sizeof(i2cClockSteps) / sizeof(i2cClockSteps[0]); k++) {
+        uint32_t clk = i2cClockSteps[k];
+        if (clk > i2cClock) continue;
+        if (clk == I2C_CLOCK_STANDARD || trySetBusClock(clk, prescale)) {
+            busClock = clk;
+            break;
+        }
+    }
+    if (busClock == I2C_CLOCK_STANDARD) {
+        Wire.setClock(I2C_CLOCK_STANDARD);
+    }
+    setupI2CQueue(busClock);
+
+    // Default mapping: servo N → board 0, channel N, default pulse range
+    for (int s = 0; s < MAX_SERVOS; s++) {
+        servoSlots[s] = servoSlot(0, s < 16 ? s : 0);
+        setServoPulseRange(s, PWM_MIN_MICROSEC, PWM_MAX_MICROSEC);
+        shadowPulse[s] = SHADOW_UNKNOWN;
+    }
+
+    return busClock;
+}
+
+/**
+ * @brief Override the default mapping for one servo.
+ */
+void setServoMapping(int servoIndex, int boardIndex, int channel) {
+    if (servoIndex >= 0 && servoIndex < MAX_SERVOS
+     && boardIndex  >= 0 && boardIndex  < numBoards
+     && channel     >= 0 && channel     < 16) {
+        servoSlots[servoIndex]  = servoSlot(boardIndex, channel);
+        shadowPulse[servoIndex] = SHADOW_UNKNOWN;  // New channel: state unknown.
+    }
+}
+
+/**
+ * @brief Map a run of servos from a slot table; bad entries leave the
+ *        servo unmapped.
+ */
+void setServoSlots(const uint8_t slots[], uint8_t count) {
+    if (count > MAX_SERVOS) count = MAX_SERVOS;
+    for (uint8_t s = 0; s < count; s++) {
+        uint8_t slot = slots[s];
+        servoSlots[s]  = (slot != SERVO_UNMAPPED && slotBoard(slot) < numBoards)
+                       ? slot : SERVO_UNMAPPED;
+        shadowPulse[s] = SHADOW_UNKNOWN;
+    }
+}
+
+/**
+ * @brief Store one servo's range as a count offset and a per-degree step.
+ */
+bool setServoPulseRange(int servoIndex, uint16_t minMicros, uint16_t maxMicros) {
+    if (servoIndex < 0 || servoIndex >= MAX_SERVOS || minMicros >= maxMicros) {
+        return false;
+    }
+    // µs → 12-bit counts over one PWM period (same scaling as servomin/max)
+    uint32_t lo = (uint32_t)minMicros * 4096UL * PWM_FREQUENCY / 1000000UL;
+    uint32_t hi = (uint32_t)maxMicros * 4096UL * PWM_FREQUENCY / 1000000UL;
+    if (hi > 4095) return false;
+
+    pulseMin[servoIndex]   = (uint16_t)lo;
+    pulseScale[servoIndex] = (uint16_t)((((hi - lo) << 8) + MAX_SERVO_ANGLE / 2)
+                                        / MAX_SERVO_ANGLE);
+    return true;
+}
+
+/**
+ * @brief Angle to pulse count, per servo: one multiply and a shift.
+ */
+uint16_t servoAngleToPulse(int servoIndex, int angle) {
+    if (angle < 0) angle = 0;
+    if (angle > MAX_SERVO_ANGLE) angle = MAX_SERVO_ANGLE;
+    return pulseMin[servoIndex]
+         + (uint16_t)(((uint32_t)pulseScale[servoIndex] * (uint8_t)angle) >> 8);
+}
+
+/**
+ * @brief Convert angle to pulse count.
+ */
+int angleToPulse(int angle) {
+    // Clamp angle
+    if (angle < 0) angle = 0;
+    if (angle > MAX_SERVO_ANGLE) angle = MAX_SERVO_ANGLE;
+
+    return map(angle, 0, MAX_SERVO_ANGLE, servomin, servomax);
+}
+
+/**
+ * @brief Move a logical servo to the specified angle.
+ */
+void setServoAngle(int servoIndex, int angle) {
+    if (servoIndex < 0 || servoIndex >= MAX_SERVOS) return;
+
+    uint8_t slot = servoSlots[servoIndex];  // Checked against numBoards when mapped.
+    if (slot == SERVO_UNMAPPED) return;
+    uint16_t pulse = servoAngleToPulse(servoIndex, angle);
+
+    i2cQueueFlush();  // Queued moves must not land after this one.
+    pwmBoards[slotBoard(slot)].setPWM(slotChannel(slot), 0, pulse);
+    shadowPulse[servoIndex] = pulse;
+    ++writeStats.written;
+}
+
+/**
+ * @brief Record a move to be written by the next commitStagedServos().
+ */
+void stageServoAngle(int servoIndex, int angle) {
+    if (servoIndex < 0 || servoIndex >= MAX_SERVOS) return;
+    stageServoPulse(servoIndex, servoAngleToPulse(servoIndex, angle));
+}
+
+/**
+ * @brief Record a raw pulse count for the next commitStagedServos().
+ */
+void stageServoPulse(int servoIndex, uint16_t pulse) {
+    if (servoIndex < 0 || servoIndex >= MAX_SERVOS) return;
+
+    uint8_t slot = servoSlots[servoIndex];
+    if (slot == SERVO_UNMAPPED) return;
+    uint8_t b = slotBoard(slot);
+    uint8_t c = slotChannel(slot);
+    stagedPulse[b][c] = pulse > 4095 ? 4095 : pulse;
+    stagedServo[b][c] = servoIndex;
+    stagedMask[b]    |= (uint16_t)1 << c;
+}
+
+// The burst built last is held back until the next one exists (then it is
+// queued ending in a repeated START) or the commit ends (then with STOP). A
+// whole commit is therefore one bus transaction, and since every board
+// updates its outputs on STOP (MODE2 OCH clear), moves on both boards take
+// effect together at the final STOP.
+static uint8_t heldBurst[I2C_QUEUE_BYTES];
+static uint8_t heldLen  = 0;
+static uint8_t heldAddr = 0;
+
+static void releaseHeld(bool stop) {
+    if (heldLen) i2cQueueWrite(heldAddr, heldBurst, heldLen, stop);
+    heldLen = 0;
+}
+
+/**
+ * @brief Build one register burst: LEDn_ON_L address, then ON = 0 and the
+ *        OFF count for each channel (the layout setPWMMulti() writes).
+ */
+static void queueRun(uint8_t addr, const uint16_t* pulses, uint8_t first, uint8_t count) {
+    releaseHeld(false);
+    heldBurst[0] = PCA9685_LED0_ON_L + 4 * first;
+    for (uint8_t i = 0; i < count; i++) {
+        uint16_t off = pulses[first + i];
+        heldBurst[1 + 4 * i] = 0;
+        heldBurst[2 + 4 * i] = 0;
+        heldBurst[3 + 4 * i] = off;
+        heldBurst[4 + 4 * i] = off >> 8;
+    }
+    heldAddr = addr;
+    heldLen  = 1 + 4 * count;
+}
+
+/**
+ * @brief One burst per run of adjacent channels in mask; runs longer than
+ *        one transaction go out in pieces.
+ */
+static void queueRuns(uint8_t addr, const uint16_t* pulses, uint16_t mask) {
+    const uint8_t perWrite = (I2C_QUEUE_BYTES - 1) / 4;
+    uint8_t c = 0;
+    while (mask) {
+        // Skip to the start of the next run of staged channels
+        while (!(mask & 1)) { mask >>= 1; c++; }
+        uint8_t first = c;
+        while (mask & 1)    { mask >>= 1; c++; }
+        for (uint8_t at = first; at < c; at += perWrite) {
+            queueRun(addr, pulses, at, (c - at < perWrite) ? c - at : perWrite);
+        }
+    }
+}
+
+#if !USE_ASYNC_I2C
+/**
+ * @brief Write each run of adjacent channels in mask straight to one board;
+ *        setPWMMulti() splits a run to fit the Wire buffer.
+ */
+static void writeRuns(Adafruit_PWMServoDriver& board, const uint16_t* pulses, uint16_t mask) {
+    uint8_t c = 0;
+    while (mask) {
+        while (!(mask & 1)) { mask >>= 1; c++; }
+        uint8_t first = c;
+        while (mask & 1)    { mask >>= 1; c++; }
+        board.setPWMMulti(first, c - first, pulses + first);
+    }
+}
+#endif
+
+/**
+ * @brief Queue staged moves as one bus transaction that latches at its STOP.
+ *
+ * Without async I2C every write waits anyway, so each board's runs go out
+ * through setPWMMulti() instead, one transaction (and latch) per run.
+ */
+void commitStagedServos() {
+    // A refused transfer leaves the board state unknown: rewrite everything.
+    uint16_t refused = i2cQueueStats().refused;
+    if (refused != shadowRefused) {
+        shadowRefused = refused;
+        invalidateServoShadow();
+    }
+    bool force = forceNextCommit;
+    forceNextCommit = false;
+
+    for (int b = 0; b < numBoards; b++) {
+        // Drop channels already at their staged pulse, then update the shadow
+        for (uint8_t c = 0; c < 16; c++) {
+            uint16_t bit = (uint16_t)1 << c;
+            if (!(stagedMask[b] & bit)) continue;
+            uint16_t& shadow = shadowPulse[stagedServo[b][c]];
+            if (!force && shadow == stagedPulse[b][c]) {
+                stagedMask[b] &= ~bit;
+                ++writeStats.saved;
+            } else {
+                shadow = stagedPulse[b][c];
+                ++writeStats.written;
+            }
+        }
+    }
+
+#if USE_ALLCALL
+    // Channels moving to the same pulse on every board: one All Call write
+    if (numBoards > 1) {
+        uint16_t common = stagedMask[0];
+        for (int b = 1; b < numBoards; b++) common &= stagedMask[b];
+        for (uint8_t c = 0; c < 16; c++) {
+            for (int b = 1; b < numBoards; b++) {
+                if (stagedPulse[b][c] != stagedPulse[0][c]) common &= ~((uint16_t)1 << c);
+            }
+        }
+        if (common) {
+            queueRuns(PCA9685_ALLCALL_ADDRESS, stagedPulse[0], common);
+            for (int b = 0; b < numBoards; b++) stagedMask[b] &= ~common;
+        }
+    }
+#endif
+
+#if USE_ASYNC_I2C
+    for (int b = 0; b < numBoards; b++) {
+        queueRuns(boardAddr[b], stagedPulse[b], stagedMask[b]);
+        stagedMask[b] = 0;
+    }
+    releaseHeld(true);
+#else
+    releaseHeld(true);  // All Call runs, if any
+    i2cQueueFlush();    // Queued writes must not be overtaken by direct ones.
+    for (int b = 0; b < numBoards; b++) {
+        writeRuns(pwmBoards[b], stagedPulse[b], stagedMask[b]);
+        stagedMask[b] = 0;
+    }
+#endif
+}
+
+/**
+ * @brief Forget every committed pulse so each servo is written again.
+ */
+void invalidateServoShadow() {
+    for (int s = 0; s < MAX_SERVOS; s++) shadowPulse[s] = SHADOW_UNKNOWN;
+}
+
+/**
+ * @brief Write every servo staged for the next commit, changed or not.
+ */
+void forceServoRefresh() {
+    forceNextCommit = true;
+}
+
+const ServoWriteStats& servoWriteStats() {
+    return writeStats;
+}
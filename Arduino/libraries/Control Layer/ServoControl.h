@@ -1,73 +1,188 @@
-#ifndef SERVO_CONTROL_H
-#define SERVO_CONTROL_H
-
-#include <Arduino.h>
-#include <Wire.h>
-#include <Adafruit_PWMServoDriver.h>
-
-// ─── Configuration ────────────────────────────────────────────────────────────
-
-// Maximum number of daisy-chained PCA9685 boards
-#define MAX_BOARDS    2
-
-// Maximum number of logical servos across all boards
-#define MAX_SERVOS   18
-
-// PWM pulse width range (microseconds)
-#define PWM_MIN_MICROSEC  400   // Minimum pulse
-#define PWM_MAX_MICROSEC 2600   // Maximum pulse
-
-// Servo angle range (degrees)
-#define MAX_SERVO_ANGLE  180
-
-// PCA9685 PWM frequency (Hz)
-#define PWM_FREQUENCY     60
-
-// ─── Externally visible data structures ──────────────────────────────────────
-
-// One Adafruit driver instance per board
-extern Adafruit_PWMServoDriver pwmBoards[MAX_BOARDS];
-
-// Number of boards initialised
-extern int numBoards;
-
-// Mapping from logical servo index → board index (0…numBoards-1)
-extern int servoBoard[MAX_SERVOS];
-
-// Mapping from logical servo index → channel on its board (0…15)
-extern int servoChannel[MAX_SERVOS];
-
-// ─── Public API ────────────────────────────────────────────────────────────────
-
-/**
- * @brief Initialise all PCA9685 boards.
- * @param i2cAddrs Array of I2C addresses (e.g. {0x40, 0x41})
- * @param count    Number of addresses in the array (≤ MAX_BOARDS)
- *
- * Must be called once in setup() before any mapping or angle commands.
- */
-void setupServoDrivers(const uint8_t i2cAddrs[], int count);
-
-/**
- * @brief Define which board and channel a logical servo uses.
- * @param servoIndex  Logical index (0…MAX_SERVOS−1)
- * @param boardIndex  Which PCA9685 (0…numBoards−1)
- * @param channel     Which PWM channel (0…15) on that board
- */
-void setServoMapping(int servoIndex, int boardIndex, int channel);
-
-/**
- * @brief Move a logical servo to a given angle.
- * @param servoIndex  Logical index (0…MAX_SERVOS−1)
- * @param angle       Desired angle (0…MAX_SERVO_ANGLE)
- */
-void setServoAngle(int servoIndex, int angle);
-
-/**
- * @brief Convert angle to pulse count (for debugging and verification).
- * @param angle       Desired angle (0…MAX_SERVO_ANGLE)
- * @return           Pulse width value sent to the PCA9685
- */
-int angleToPulse(int angle);
-
-#endif  // SERVO_CONTROL_H
+#ifndef SERVO_CONTROL_H
+#define SERVO_CONTROL_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <Adafruit_PWMServoDriver.h>
+#include "I2CQueue.h"
+
+// ─── Configuration ────────────────────────────────────────────────────────────
+
+// Maximum number of daisy-chained PCA9685 boards (at most 15, see servoSlot()).
+// Every per-board and per-servo table in the library is sized from these;
+// change them here only, never from a sketch, so every file agrees.
+#define MAX_BOARDS    2
+
+// Maximum number of logical servos across all boards
+#define MAX_SERVOS   18
+
+// PWM pulse width range (microseconds)
+#define PWM_MIN_MICROSEC  400   // Minimum pulse
+#define PWM_MAX_MICROSEC 2600   // Maximum pulse
+
+// Servo angle range (degrees)
+#define MAX_SERVO_ANGLE  180
+
+// PCA9685 PWM frequency (Hz)
+#define PWM_FREQUENCY     60
+
+// Send moves that are identical on every board once, to the PCA9685 All Call
+// address (PCA9685_ALLCALL_ADDRESS). Nothing else on the bus may use it.
+// ServoControl.cpp is built on its own, so set this here, not in a sketch.
+#define USE_ALLCALL 1
+
+// I2C bus clock options (Hz); the PCA9685 supports all three
+#define I2C_CLOCK_STANDARD    100000UL  // Standard mode (Wire default)
+#define I2C_CLOCK_FAST        400000UL  // Fast mode
+#define I2C_CLOCK_FAST_PLUS  1000000UL  // Fast-mode Plus; beyond the ATmega2560's rating, opt-in only
+
+// ─── Servo slots ──────────────────────────────────────────────────────────────
+
+// Where a servo is wired, packed into one byte: board in the high nibble,
+// channel in the low one. constexpr, so a table of slots written with it
+// is a plain byte array (see RemoteScheduler.ino) and unpacking is a shift
+// and a mask.
+constexpr uint8_t servoSlot(uint8_t board, uint8_t channel) {
+    return (uint8_t)((board << 4) | (channel & 0x0F));
+}
+constexpr uint8_t slotBoard(uint8_t slot)   { return slot >> 4; }
+constexpr uint8_t slotChannel(uint8_t slot) { return slot & 0x0F; }
+
+// Slot of a servo with no channel: moves to it are ignored.
+#define SERVO_UNMAPPED 0xFF
+
+// ─── Externally visible data structures ──────────────────────────────────────
+
+// One Adafruit driver instance per board
+extern Adafruit_PWMServoDriver pwmBoards[MAX_BOARDS];
+
+// Number of boards initialised
+extern int numBoards;
+
+// Mapping from logical servo index → servoSlot(board, channel)
+extern uint8_t servoSlots[MAX_SERVOS];
+
+// ─── Public API ────────────────────────────────────────────────────────────────
+
+/**
+ * @brief Initialise all PCA9685 boards.
+ * @param i2cAddrs Array of I2C addresses (e.g. {0x40, 0x41})
+ * @param count    Number of addresses in the array (≤ MAX_BOARDS)
+ * @param i2cClock Requested I2C bus clock in Hz (see I2C_CLOCK_*)
+ * @return         Bus clock actually in use
+ *
+ * Must be called once in setup() before any mapping or angle commands.
+ * After raising the clock every board is checked; if one stops answering
+ * the next slower speed is tried, down to I2C_CLOCK_STANDARD.
+ */
+uint32_t setupServoDrivers(const uint8_t i2cAddrs[], int count,
+                           uint32_t i2cClock = I2C_CLOCK_STANDARD);
+
+/**
+ * @brief Define which board and channel a logical servo uses.
+ * @param servoIndex  Logical index (0…MAX_SERVOS−1)
+ * @param boardIndex  Which PCA9685 (0…numBoards−1)
+ * @param channel     Which PWM channel (0…15) on that board
+ */
+void setServoMapping(int servoIndex, int boardIndex, int channel);
+
+/**
+ * @brief Map servos 0…count−1 from a table of slots in one call.
+ * @param slots  servoSlot(board, channel) per servo, or SERVO_UNMAPPED
+ * @param count  Entries in slots (≤ MAX_SERVOS)
+ */
+void setServoSlots(const uint8_t slots[], uint8_t count);
+
+/**
+ * @brief Set the pulse range one servo sweeps over from 0° to MAX_SERVO_ANGLE.
+ * @param servoIndex  Logical index (0…MAX_SERVOS−1)
+ * @param minMicros   Pulse width at 0°
+ * @param maxMicros   Pulse width at MAX_SERVO_ANGLE
+ * @return            false if the index or range is invalid (nothing changes)
+ *
+ * The range is converted to PCA9685 counts once, here, so moves only need a
+ * multiply and a shift. setupServoDrivers() starts every servo at
+ * PWM_MIN_MICROSEC…PWM_MAX_MICROSEC; the Pi uploads its calibration after.
+ */
+bool setServoPulseRange(int servoIndex, uint16_t minMicros, uint16_t maxMicros);
+
+/**
+ * @brief Pulse count for a servo at an angle, using its calibrated range.
+ * @param servoIndex  Logical index (0…MAX_SERVOS−1)
+ * @param angle       Desired angle, clamped to 0…MAX_SERVO_ANGLE
+ */
+uint16_t servoAngleToPulse(int servoIndex, int angle);
+
+/**
+ * @brief Move a logical servo to a given angle.
+ * @param servoIndex  Logical index (0…MAX_SERVOS−1)
+ * @param angle       Desired angle (0…MAX_SERVO_ANGLE)
+ */
+void setServoAngle(int servoIndex, int angle);
+
+/**
+ * @brief Queue a servo move without touching the bus yet.
+ * @param servoIndex  Logical index (0…MAX_SERVOS−1)
+ * @param angle       Desired angle (0…MAX_SERVO_ANGLE)
+ *
+ * Staged moves are written by commitStagedServos(); staging the same servo
+ * twice keeps only the latest angle.
+ */
+void stageServoAngle(int servoIndex, int angle);
+
+/**
+ * @brief Queue a raw pulse count for a servo (no angle conversion).
+ * @param servoIndex  Logical index (0…MAX_SERVOS−1)
+ * @param pulse       PCA9685 off count (0…4095)
+ */
+void stageServoPulse(int servoIndex, uint16_t pulse);
+
+/**
+ * @brief Write every staged move, one burst per run of adjacent channels.
+ *
+ * A servo whose staged pulse equals the last one committed to it is left
+ * out (see forceServoRefresh() and invalidateServoShadow()).
+ *
+ * Channels staged on the same board that sit next to each other go out in a
+ * single auto-increment burst, and the bursts for every board are chained
+ * with repeated STARTs into one I2C transaction. The boards update their
+ * outputs on STOP, so everything committed together moves together, on both
+ * boards. The bursts are queued on the I2C transmit queue and this returns at
+ * once; i2cQueuePump() sends the rest as the bus frees up.
+ */
+void commitStagedServos();
+
+// Per-channel write totals since start-up.
+struct ServoWriteStats {
+    uint32_t written;   // Channel updates sent to a board.
+    uint32_t saved;     // Staged moves skipped: the servo already had that pulse.
+};
+
+/**
+ * @brief Forget the last committed pulse of every servo.
+ *
+ * The next move of each servo is written even if it matches. Done on its own
+ * when the I2C queue refuses a transfer at its start. A NACK is not seen with
+ * async I2C, so a write the board missed is only put right by a forced
+ * refresh (RESET does one) or a later move of that servo.
+ */
+void invalidateServoShadow();
+
+/**
+ * @brief Make the next commitStagedServos() write every staged channel,
+ *        whether or not its pulse changed.
+ */
+void forceServoRefresh();
+
+// Write totals since start-up.
+const ServoWriteStats& servoWriteStats();
+
+/**
+ * @brief Convert angle to pulse count with the default range (for debugging
+ *        and verification).
+ * @param angle       Desired angle (0…MAX_SERVO_ANGLE)
+ * @return           Pulse width value sent to the PCA9685
+ */
+int angleToPulse(int angle);
+
+#endif  // SERVO_CONTROL_H
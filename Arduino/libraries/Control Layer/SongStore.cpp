@@ -0,0 +1,136 @@
+#include "SongStore.h"
+#include "I2CQueue.h"
+
+#ifdef SONG_STORE_FRAM_ADDR
+#include <Adafruit_I2CDevice.h>
+static Adafruit_I2CDevice fram(SONG_STORE_FRAM_ADDR);
+#define SONG_STORE_BYTES  SONG_STORE_FRAM_BYTES
+#define FRAM_CHUNK        24  // Data bytes per write, under the 32-byte Wire buffer.
+#else
+#include <EEPROM.h>
+#define SONG_STORE_BYTES  ((uint32_t)EEPROM.length())
+#endif
+
+#define CRC8_POLY 0x07  // Same CRC-8 as the frame check: init 0, no final XOR.
+
+static SongStoreInfo info;
+static uint16_t      pendingCount = 0;  // Records of the upload in progress.
+
+// ─── Backend ──────────────────────────────────────────────────────────────────
+
+static void memRead(uint16_t addr, uint8_t* buf, uint8_t n) {
+#ifdef SONG_STORE_FRAM_ADDR
+    i2cQueueFlush();  // Servo bursts first; Wire waits for the last one.
+    uint8_t a[2] = { (uint8_t)(addr >> 8), (uint8_t)addr };
+    fram.write_then_read(a, 2, buf, n);
+#else
+    for (uint8_t i = 0; i < n; ++i) buf[i] = EEPROM.read(addr + i);
+#endif
+}
+
+static void memWrite(uint16_t addr, const uint8_t* buf, uint8_t n) {
+#ifdef SONG_STORE_FRAM_ADDR
+    i2cQueueFlush();
+    while (n > 0) {
+        uint8_t part = n > FRAM_CHUNK ? FRAM_CHUNK : n;
+        uint8_t a[2] = { (uint8_t)(addr >> 8), (uint8_t)addr };
+        fram.write(buf, part, true, a, 2);
+        addr += part;
+        buf  += part;
+        n    -= part;
+    }
+#else
+    for (uint8_t i = 0; i < n; ++i) EEPROM.update(addr + i, buf[i]);  // Skips unchanged cells.
+#endif
+}
+
+static uint8_t crc8Update(uint8_t crc, uint8_t b) {
+    crc ^= b;
+    for (uint8_t i = 0; i < 8; ++i) {
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ CRC8_POLY) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+static uint32_t readLE(const uint8_t* p, uint8_t n) {
+    uint32_t v = 0;
+    for (uint8_t i = n; i-- > 0;) v = (v << 8) | p[i];
+    return v;
+}
+
+static void writeLE(uint8_t* p, uint32_t v, uint8_t n) {
+    for (uint8_t i = 0; i < n; ++i, v >>= 8) p[i] = (uint8_t)v;
+}
+
+// ─── Public API ───────────────────────────────────────────────────────────────
+
+void setupSongStore() {
+#ifdef SONG_STORE_FRAM_ADDR
+    fram.begin();
+#endif
+    uint8_t h[SONG_STORE_HEADER_SIZE];
+    memRead(0, h, sizeof(h));
+    info.valid   = readLE(h, 2) == SONG_STORE_MAGIC;
+    info.count   = readLE(h + 2, 2);
+    info.id      = readLE(h + 4, 4);
+    info.endTime = readLE(h + 8, 4);
+    if (info.count > songStoreCapacity()) info.valid = false;
+}
+
+uint16_t songStoreCapacity() {
+    uint32_t n = (SONG_STORE_BYTES - SONG_STORE_HEADER_SIZE) / SONG_STORE_RECORD_SIZE;
+    return n > 0xFFFF ? 0xFFFF : (uint16_t)n;
+}
+
+bool songStoreBegin(uint32_t id, uint16_t count, uint32_t endTime) {
+    if (count > songStoreCapacity()) return false;
+    uint8_t none[2] = { 0, 0 };
+    memWrite(0, none, 2);  // No valid song until songStoreFinish().
+    info.valid   = false;
+    info.id      = id;
+    info.count   = count;
+    info.endTime = endTime;
+    pendingCount = count;
+    return true;
+}
+
+bool songStoreWrite(uint16_t index, const uint8_t* data, uint8_t n) {
+    if ((uint32_t)index + n > pendingCount) return false;
+    memWrite(SONG_STORE_HEADER_SIZE + (uint16_t)index * SONG_STORE_RECORD_SIZE,
+             data, n * SONG_STORE_RECORD_SIZE);
+    return true;
+}
+
+bool songStoreFinish(uint8_t crc) {
+    // Read back rather than trust the writes: a worn EEPROM cell fails here.
+    uint8_t  got = 0;
+    uint8_t  rec[SONG_STORE_RECORD_SIZE];
+    for (uint16_t i = 0; i < pendingCount; ++i) {
+        memRead(SONG_STORE_HEADER_SIZE + i * SONG_STORE_RECORD_SIZE, rec, sizeof(rec));
+        for (uint8_t j = 0; j < sizeof(rec); ++j) got = crc8Update(got, rec[j]);
+    }
+    if (got != crc) return false;
+
+    uint8_t h[SONG_STORE_HEADER_SIZE] = { 0 };
+    writeLE(h + 2, pendingCount, 2);
+    writeLE(h + 4, info.id, 4);
+    writeLE(h + 8, info.endTime, 4);
+    h[12] = crc;
+    memWrite(2, h + 2, sizeof(h) - 2);
+    writeLE(h, SONG_STORE_MAGIC, 2);
+    memWrite(0, h, 2);      // Magic last: the song is valid from here.
+    info.valid = true;
+    return true;
+}
+
+const SongStoreInfo& songStoreInfo() {
+    return info;
+}
+
+void songStoreRead(uint16_t index, uint8_t& target, uint8_t& angle, uint32_t& delta) {
+    uint8_t rec[SONG_STORE_RECORD_SIZE];
+    memRead(SONG_STORE_HEADER_SIZE + index * SONG_STORE_RECORD_SIZE, rec, sizeof(rec));
+    target = rec[0];
+    angle  = rec[1];
+    delta  = readLE(rec + 2, 3);
+}
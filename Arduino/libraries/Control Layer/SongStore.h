@@ -0,0 +1,85 @@
+#ifndef SONG_STORE_H
+#define SONG_STORE_H
+
+#include <Arduino.h>
+
+// ─── Configuration ────────────────────────────────────────────────────────────
+
+// A song uploaded by the Pi is kept in non-volatile memory so the Mega can
+// play it with nothing on the serial link but start and stop. The
+// application flash cannot hold it: the ATmega2560 only runs SPM from the
+// bootloader section, so a running sketch cannot write its own flash. The
+// store is the internal EEPROM (4 KB, about 800 records) unless
+// SONG_STORE_FRAM_ADDR names an I2C FRAM (MB85RC-style, 2-byte addressing)
+// on the servo bus, which holds SONG_STORE_FRAM_BYTES.
+// #define SONG_STORE_FRAM_ADDR  0x50
+#ifndef SONG_STORE_FRAM_BYTES
+#define SONG_STORE_FRAM_BYTES 32768UL
+#endif
+
+// Header at offset 0: magic(2) + count(2) + id(4) + endTime(4) + crc(1),
+// padded to SONG_STORE_HEADER_SIZE. The magic is written last, so a
+// half-finished upload never reads back as a song.
+#define SONG_STORE_MAGIC       0x5347  // "SG"
+#define SONG_STORE_HEADER_SIZE 16
+
+// Record: target(1) + angle(1) + delta(3, LE µs after the previous record,
+// or after song time 0 for the first). Songs are sorted by time, so a delta
+// is never negative; the Pi refuses songs with a gap of 16.7 s or more.
+#define SONG_STORE_RECORD_SIZE 5
+
+// ─── Public API ────────────────────────────────────────────────────────────────
+
+// The stored song, as uploaded.
+struct SongStoreInfo {
+    bool     valid;    // A complete, verified song is stored.
+    uint32_t id;       // The Pi's id for it (from the compiled song digest).
+    uint16_t count;    // Records.
+    uint32_t endTime;  // Song µs of the end-of-song marker.
+};
+
+/**
+ * @brief Open the store and read the header of any song kept from before.
+ *
+ * Call before setupServoDrivers(): the FRAM driver's begin() restarts Wire
+ * at its default clock.
+ */
+void setupSongStore();
+
+// Records the store can hold.
+uint16_t songStoreCapacity();
+
+/**
+ * @brief Start an upload, invalidating the stored song.
+ * @return false if count records do not fit (the old song is kept)
+ */
+bool songStoreBegin(uint32_t id, uint16_t count, uint32_t endTime);
+
+/**
+ * @brief Write n records of SONG_STORE_RECORD_SIZE bytes from record index on.
+ * @return false if they run past the count given to songStoreBegin()
+ *
+ * EEPROM cells are only written where they change, ~3.4 ms per byte, so the
+ * call blocks; uploads are only accepted while no song is playing.
+ */
+bool songStoreWrite(uint16_t index, const uint8_t* data, uint8_t n);
+
+/**
+ * @brief Verify the records read back against the Pi's CRC-8 and, if they
+ *        match, write the header that makes the song valid.
+ */
+bool songStoreFinish(uint8_t crc);
+
+// Header of the stored song; valid is false if there is none.
+const SongStoreInfo& songStoreInfo();
+
+/**
+ * @brief Read one record.
+ * @param index   Record number (< count)
+ * @param target  Servo or pose target
+ * @param angle   Angle
+ * @param delta   µs after the previous record
+ */
+void songStoreRead(uint16_t index, uint8_t& target, uint8_t& angle, uint32_t& delta);
+
+#endif  // SONG_STORE_H
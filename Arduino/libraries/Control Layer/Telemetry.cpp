@@ -0,0 +1,52 @@
+#include "Telemetry.h"
+
+Telemetry::Telemetry()
+  : head(0), count(0), nextSeq(0), droppedPending(0), droppedTotal(0),
+    enabled(false)
+{}
+
+void Telemetry::log(uint8_t type, uint8_t target, uint8_t angle,
+                    uint32_t time, int32_t arg, uint16_t depth) {
+    if (!enabled) return;
+    // Report earlier losses first, while there is room for both records.
+    if (droppedPending > 0 && count <= TELEMETRY_RING_RECORDS - 2) {
+        push(TEL_DROPPED, 0, 0, 0, droppedPending, 0);
+        droppedPending = 0;
+    }
+    if (droppedPending > 0 || !push(type, target, angle, time, arg, depth)) {
+        if (droppedPending < 0xFFFF) ++droppedPending;
+        if (droppedTotal < 0xFFFF)   ++droppedTotal;
+    }
+}
+
+// Pack a record into the next free slot; false if the ring is full.
+bool Telemetry::push(uint8_t type, uint8_t target, uint8_t angle,
+                     uint32_t time, int32_t arg, uint16_t depth) {
+    if (count >= TELEMETRY_RING_RECORDS) return false;
+    if (arg >  32767) arg =  32767;
+    if (arg < -32768) arg = -32768;
+
+    uint8_t* r = ring[(head + count) % TELEMETRY_RING_RECORDS];
+    r[0]  = TELEMETRY_MARKER;
+    r[1]  = type;
+    r[2]  = nextSeq++;
+    r[3]  = target;
+    r[4]  = angle;
+    r[5]  = depth > 255 ? 255 : (uint8_t)depth;
+    r[6]  = (uint8_t)arg;
+    r[7]  = (uint8_t)((uint16_t)arg >> 8);
+    r[8]  = (uint8_t)time;
+    r[9]  = (uint8_t)(time >> 8);
+    r[10] = (uint8_t)(time >> 16);
+    r[11] = (uint8_t)(time >> 24);
+    ++count;
+    return true;
+}
+
+void Telemetry::drain() {
+    while (count > 0 && Serial.availableForWrite() >= TELEMETRY_RECORD_SIZE) {
+        Serial.write(ring[head], TELEMETRY_RECORD_SIZE);
+        head = (head + 1) % TELEMETRY_RING_RECORDS;
+        --count;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+
+// ─── Configuration ────────────────────────────────────────────────────────────
+
+// Records waiting for TX space. Each costs TELEMETRY_RECORD_SIZE bytes of SRAM.
+// The ring is part of RemoteControl, so change it here, never from a sketch.
+#define TELEMETRY_RING_RECORDS 32
+
+// Binary record: marker(1) + type(1) + seq(1) + target(1) + angle(1) +
+// depth(1) + arg(2, LE) + time(4, LE). The marker is above 0x7F so the Pi can
+// tell a record from a text line at any line boundary.
+#define TELEMETRY_MARKER      0xCF
+#define TELEMETRY_RECORD_SIZE 12
+
+// Event types; the meaning of target/angle/arg/time is listed per event and
+// mirrored by RasPi/telemetry.py.
+enum TelemetryEvent : uint8_t {
+    TEL_BOOT      = 0x01,  // arg = I2C clock (kHz)
+    TEL_MAP       = 0x02,  // target = servo, angle = board, arg = channel
+    TEL_SYNC      = 0x03,  // time = micros() at song time 0
+    TEL_RECEIVED  = 0x04,  // target/angle, time = scheduled µs, depth = queue size
+    TEL_BATCH     = 0x05,  // target = record count, time = base µs, depth = queue size
+    TEL_EXECUTED  = 0x06,  // target/angle, time = scheduled µs, arg = lateness µs, depth
+    TEL_CLOCK_ADJ = 0x07,  // time = reference song µs, arg = rate (ppm)
+    TEL_RESET     = 0x08,  // servos moved to their RESET angles
+    TEL_DONE      = 0x09,  // time = song µs when the end marker ran
+    TEL_DROPPED   = 0x0A,  // arg = records lost because the ring was full
+    TEL_NACK      = 0x0B,  // target = expected seq, angle = reason, arg = bad frames so far
+    TEL_BAUD      = 0x0C,  // time = new serial rate
+    TEL_I2C       = 0x0D,  // target = max queue depth, angle = stalls, time = sent, arg = refused
+    TEL_WRITES    = 0x0E,  // time = unchanged writes skipped, arg = share skipped (per mille)
+};
+
+/**
+ * @brief Fixed-size ring of binary event records for the Pi.
+ *
+ * log() never blocks: records wait in the ring and drain() writes whole
+ * records only while the serial TX buffer has room for them. When the ring
+ * is full new records are dropped and counted; the count goes out as a
+ * TEL_DROPPED record once space frees up. Each record carries an 8-bit
+ * sequence number, so the reader can also spot gaps on its own.
+ */
+class Telemetry {
+public:
+    Telemetry();
+
+    // Turn recording on or off; while off, log() does nothing.
+    void setEnabled(bool on) { enabled = on; }
+    bool isEnabled() const   { return enabled; }
+
+    /**
+     * @brief Queue one record.
+     * @param type    TelemetryEvent value
+     * @param target  Servo index or event-specific byte
+     * @param angle   Angle or event-specific byte
+     * @param time    Event-specific 32-bit time (see TelemetryEvent)
+     * @param arg     Event-specific signed value, saturated to 16 bits
+     * @param depth   Queue depth, saturated to 255
+     */
+    void log(uint8_t type, uint8_t target = 0, uint8_t angle = 0,
+             uint32_t time = 0, int32_t arg = 0, uint16_t depth = 0);
+
+    // Write as many queued records as fit in the TX buffer without blocking.
+    void drain();
+
+    // Records dropped since start-up.
+    uint16_t dropped() const { return droppedTotal; }
+
+private:
+    bool push(uint8_t type, uint8_t target, uint8_t angle,
+              uint32_t time, int32_t arg, uint16_t depth);
+
+    uint8_t  ring[TELEMETRY_RING_RECORDS][TELEMETRY_RECORD_SIZE];
+    uint8_t  head;            // Next record to send.
+    uint8_t  count;           // Records waiting.
+    uint8_t  nextSeq;
+    uint16_t droppedPending;  // Dropped since the last TEL_DROPPED record.
+    uint16_t droppedTotal;
+    bool     enabled;
+};
+
+#endif  // TELEMETRY_H
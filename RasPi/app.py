@@ -1,28 +1,45 @@
 #!/usr/bin/env python3
-from flask import Flask, jsonify, request           # Import Flask web framework components.
+from flask import Flask, Response, jsonify, request  # Import Flask web framework components.
 import threading                                     # Import threading for background playback.
 import os                                            # Import os for filesystem operations.
 import time                                         # Import time for timestamps.
-import json                                         # Import json for parsing song files.
 import logging                                      # Import logging to configure server logs.
+import json                                         # Import json to read song files.
 
 import scheduler                                    # Import scheduler module for song playback.
-from scheduler import play_song, stop_song          # Import core playback controls.
-from scheduler import ms_per_beat, SYNC_DELAY_MS    # Import timing constants.
-from scheduler import resolve_command
+import songcompiler                                 # Import compiled, cached song streams.
+import library                                      # Import the indexed song library.
+import validator                                    # Import playability checks.
+import events                                       # Import the server-sent event fan-out.
+from scheduler import play_song                     # Import core playback controls.
+from scheduler import SYNC_DELAY_MS                 # Import timing constants.
 
 # Silence Flask's default access logs below WARNING level to reduce console noise.
 logging.getLogger('werkzeug').setLevel(logging.WARNING)
 
 app = Flask(__name__)                                # Initialise Flask application instance.
 
+# One serial session per controller in scheduler.DEVICES for the whole
+# process: play, stop and status share them, and songs play on all at once.
+ensemble = scheduler.Ensemble()
+
+# Song library index: /songs answers from memory, rescanning only changed files.
+songs = library.SongLibrary()
+
+# Playback state and progress pushed to every /events stream.
+hub = events.EventHub()
+hub.publish('state', {'state': 'idle', 'song': None})
+
 # Reset state funciton
 def reset_playback_state():
-    global _play_thread, _current_song, _start_time, _song_length_ms
+    global _play_thread, _current_song, _start_time, _song_length_ms, _analysis
     _play_thread = None
     _current_song = None
     _start_time = 0.0
     _song_length_ms = 0
+    _analysis = None
+    hub.forget('progress')
+    hub.publish('state', {'state': 'idle', 'song': None})
     
 # Thread watcher to join and reset state
 def watch_playback_thread():
@@ -39,6 +56,7 @@ _play_thread: threading.Thread | None = None          # Thread object running pl
 _current_song: str | None = None                      # Name of song currently playing.
 _start_time: float = 0.0                              # Pi timestamp when song starts (ms).
 _song_length_ms: int = 0                              # Total song duration in ms.
+_analysis: songcompiler.SongAnalysis | None = None    # Compile-time facts about the current song.
 
 # --- Route: Serve front-end --------------------------------------------------
 
@@ -52,11 +70,27 @@ def index():
 @app.route('/songs', methods=['GET'])
 def list_songs():
     """
-    Return list of JSON song filenames (without extension).
+    Return metadata for every song, sorted by name: length_ms, bpm,
+    strings, servos, chords and validation status (see library.py).
+    """
+    return jsonify(songs.songs())                    # Served from the index, no scan.
+
+# --- Route: Check a song ---------------------------------------------------
+
+@app.route('/validate', methods=['GET'])
+def validate_song():
+    """
+    Report servo conflicts and the fastest clean tempo for ?song=<name>.
     """
-    files = os.listdir('./songs')                    # List all files in songs directory.
-    names = [f[:-5] for f in files if f.endswith('.json')]  # Filter .json and strip suffix.
-    return jsonify(names)                            # Return names as JSON array.
+    song = request.args.get('song', '')
+    filepath = f'./songs/{song}.json'
+    if not song or not os.path.isfile(filepath):
+        return jsonify({'error': f'No such song: {song}'}), 404
+    with open(filepath) as f:
+        score = json.load(f)
+    report = validator.analyze(score, auto_shift=songcompiler.AUTO_SHIFT_PICKS)
+    report['song'] = song
+    return jsonify(report)
 
 # --- Route: Start song playback ---------------------------------------------
 
@@ -64,8 +98,9 @@ def list_songs():
 def start_playback():
     """
     Launch play_song(song) in background thread based on POST JSON {"song": name}.
+    With "local": true the song is played from the Arduino's song store.
     """
-    global _play_thread, _current_song, _start_time, _song_length_ms
+    global _play_thread, _current_song, _start_time, _song_length_ms, _analysis
 
     data = request.get_json(silent=True)            # Parse JSON payload safely.
     if not data or 'song' not in data:
@@ -82,51 +117,12 @@ def start_playback():
         # Prevent overlapping playback sessions.
         return jsonify({'status': 'already playing', 'song': _current_song}), 409
 
-    # Pre-load and flatten song JSON to compute total duration.
-    with open(filepath) as f:
-        score = json.load(f)                        # Load song structure.
-    sections = score.get('sections', {})
-    timeline = score['timeline']
-
-    flat = []                                       # Flattened list of events.
-    for ev in timeline:
-        beat, cmd = ev['beat'], ev['cmd']
-        if cmd in sections:
-            # Expand named sections into individual events.
-            for sub in sections[cmd]:
-                flat.append({'beat': beat + sub['beat'], 'cmd': sub['cmd']})
-        else:
-            flat.append(ev)                         # Keep atomic events.
-
-    # Compute playback length in ms including fret-release slack.
-    max_rel = 0
-    for ev in flat:
-        beat, cmd = ev['beat'], ev['cmd']
-        action = resolve_command(ev)
-        if action is None:
-            raise KeyError(f"Unknown command: '{ev['cmd']}'")
-        if callable(action):
-            raise RuntimeError(f"Command {ev['cmd']} did not resolve to an instance but to a function: {action}")
-
-        if hasattr(action, "actions"):
-            for act in action.actions:
-                rel = int(beat * ms_per_beat) + getattr(act, 'ms_offset', 0)
-                if isinstance(act, scheduler.FretAction):
-                    rel += act.release_after            # Include release delay.
-                if rel > max_rel:
-                    max_rel = rel                       # Track maximum relative time.
-        elif isinstance(action, scheduler.StrumCommand):
-            num_strings = len(action.strings)
-            strum_end = int(beat * ms_per_beat) + (num_strings - 1) * 15
-            rel = strum_end
-            if rel > max_rel:
-                max_rel = rel
-        else:
-            print(f"[error] Unexpected action type: {type(action)}, event: {ev}, command: {ev.get('cmd')}")
-            raise TypeError(f"Command '{ev.get('cmd')}' did not resolve to SongCommand or StrumCommand but to {type(action)}")
-
-
-    _song_length_ms = scheduler.SYNC_DELAY_MS + max_rel + scheduler.END_SLACK + 1500  # Include sync delay.
+    # Compile (or reuse the cached compile of) the song; its analysis gives
+    # the length play_song() itself will wait for, up to the END marker.
+    with songcompiler.load_song(song) as compiled:
+        _analysis = compiled.analysis
+
+    _song_length_ms = SYNC_DELAY_MS + _analysis.length_ms  # Include sync delay.
 
     # Record Pi-side start time for progress tracking (ms).
     _start_time = time.time() * 1000.0
@@ -134,6 +130,18 @@ def start_playback():
     def set_start_time_cb(val):
         global _start_time
         _start_time = val
+
+    def on_progress_cb(progress):
+        end_us = progress['end_us']
+        hub.publish('progress', {
+            'pct':      min(1.0, max(0.0, progress['song_us'] / end_us)) if end_us > 0 else 1.0,
+            'song_us':  int(progress['song_us']),
+            'beat':     round(progress['beat'], 2),
+            'section':  progress['section'],
+            'executed': progress['executed'],
+            'total':    progress['total'],
+            'source':   progress['source'],
+        })
         
     # Start the thread, passing the callback:
     _play_thread = threading.Thread(
@@ -141,16 +149,20 @@ def start_playback():
         args=(song,),
         kwargs={
             'set_start_time_cb': set_start_time_cb,
-            'on_finish_cb': _playback_finished
+            'on_finish_cb': _playback_finished,
+            'on_progress_cb': on_progress_cb,
+            'sessions': ensemble.sessions,
+            'untethered': bool(data.get('local'))
         },
         daemon=True
     )
 
     # Launch playback in daemon thread to avoid blocking server.
     _current_song = song
+    hub.publish('state', {'state': 'playing', 'song': song})
     _play_thread.start()                             # Begin asynchronous playback.
 
-    return jsonify({'status': 'started', 'song': song})
+    return jsonify({'status': 'started', 'song': song, 'analysis': _analysis.to_dict()})
 
 # --- Route: Stop current playback -------------------------------------------
 
@@ -159,13 +171,14 @@ def stop_playback():
     global _play_thread
     thread = _play_thread
     if thread and thread.is_alive():
-        stop_song()
+        song = _current_song
+        latency = ensemble.stop()                    # STOP goes out on every live link at once.
         try:
             thread.join(timeout=2.0)
         except Exception as e:
             print(f"[stop] Exception during join: {e}")
         reset_playback_state()
-        return jsonify({'status': 'stopping', 'song': _current_song})
+        return jsonify({'status': 'stopping', 'song': song, 'stop_latency_ms': latency})
     reset_playback_state()
     return jsonify({'status': 'idle'})
 
@@ -179,32 +192,78 @@ def get_status():
     playing = _play_thread is not None and _play_thread.is_alive()
     return jsonify({
         'state': 'playing' if playing else 'idle',
-        'song':  _current_song if playing else None
+        'song':  _current_song if playing else None,
+        'link':  ensemble.sessions[0].status(),
+        'devices': ensemble.status()
+    })
+
+# --- Route: Timing metrics -------------------------------------------------
+
+@app.route('/metrics', methods=['GET'])
+def get_metrics():
+    """
+    Per-board timing counters (command lateness histogram, loop period,
+    serial parse and I2C times, RX overruns, queue high-water mark) and the
+    Pi's send slack. ?clear=1 restarts the board counters after reading,
+    so a poller sees the peaks of each interval.
+    """
+    clear = request.args.get('clear', '0') not in ('0', '', 'false')
+    playing = _play_thread is not None and _play_thread.is_alive()
+    return jsonify({
+        'state':   'playing' if playing else 'idle',
+        'song':    _current_song if playing else None,
+        'devices': ensemble.metrics(clear),
     })
 
 # --- Route: Playback progress -----------------------------------------------
 
 @app.route('/progress', methods=['GET'])
 def get_progress():
-    # Calculate playback percentage based on elapsed time.
+    # Report the latest board-acknowledged progress, or elapsed time before it.
     playing = _play_thread is not None and _play_thread.is_alive()
     if not playing:
         return jsonify({'state': 'idle', 'pct': 0.0})
+    latest = hub.latest.get('progress')
+    if latest is not None:
+        return jsonify(dict(latest, state='playing'))
 
     now_ms = time.time() * 1000.0                   # Current Pi timestamp in ms.
     elapsed_ms = now_ms - _start_time               # Time since start.
     
     # Wait until sync phase is complete
+    section = None
     if elapsed_ms < SYNC_DELAY_MS:
         pct = 0.0 # Progress bar stays at 0 during sync delay
     else:
         # Only count progress after sync delay
         song_progress_ms = elapsed_ms - SYNC_DELAY_MS
         bar_length_ms = _song_length_ms - SYNC_DELAY_MS
-        pct = min(1.0, song_progress_ms / bar_length_ms)
-    return jsonify({'state': 'playing', 'pct': pct})
+        pct = min(1.0, song_progress_ms / bar_length_ms) if bar_length_ms > 0 else 1.0
+        if _analysis is not None:
+            section = _analysis.section_at(song_progress_ms * 1000.0)
+    return jsonify({'state': 'playing', 'pct': pct, 'section': section})
+
+# --- Route: Pushed playback events -----------------------------------------
+
+@app.route('/events', methods=['GET'])
+def stream_events():
+    """
+    Server-sent events on one long-lived connection: 'state' when playback
+    starts or ends, 'progress' as the boards report commands run (pct,
+    song_us, beat, section, executed/total). The latest of each is sent
+    first, so a reconnecting client is up to date at once.
+    """
+    return Response(hub.stream(), mimetype='text/event-stream',
+                    headers={'Cache-Control': 'no-cache', 'X-Accel-Buffering': 'no'})
 
 if __name__ == '__main__':
+    # Index the library before the first request so the UI loads at once.
+    songs.refresh(force=True)
+    # Connect once up front so the first song starts without the handshake.
+    try:
+        ensemble.open()
+    except Exception as e:
+        print(f"[session] Arduino not ready yet ({e}); will retry on first play")
     # Use built-in Flask server for simplicity.
-    app.run(host='0.0.0.0', port=5000)            # Listen on all interfaces port 5000.
+    app.run(host='0.0.0.0', port=5000, threaded=True)  # All interfaces, port 5000; a thread per stream.
 
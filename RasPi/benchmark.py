@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+"""
+benchmark.py
+
+
+Replay songs through the simulated Arduino (simulator.py) and report how
+the link and the scheduler kept up: packets per second, bytes each way,
+board queue occupancy, how far ahead of its deadline each command
+arrived (slack) and the notes that arrived too late (missed). Nothing but
+the Python runtime is needed, so it runs on a laptop or in CI.
+
+    python3 benchmark.py                        # Every song, start to end.
+    python3 benchmark.py --songs "Ode to Joy" --seconds 10
+    python3 benchmark.py --json after.json --compare before.json
+    python3 benchmark.py --fail-on-miss         # Exit status 1 if a note was missed.
+    python3 benchmark.py --max-baud 115200      # As on a link that will not go faster.
+
+Songs play in real time, as on the robot; --seconds stops each one early
+to keep a run short. --pty goes through a pseudo-terminal and the real
+pyserial instead of handing the simulator to the scheduler directly.
+"""
+
+import argparse                                      # Command line.
+import json                                          # Result files.
+import os                                            # Song listing.
+import sys                                           # Exit status.
+import threading                                     # Playback runs beside the timer.
+import time                                          # Wall-clock duration.
+
+import scheduler                                     # Code under test.
+import simulator                                     # Simulated Arduino.
+import songcompiler                                  # Song records and analysis.
+
+# Columns of the printed table: (result key, heading, format).
+COLUMNS = [
+    ('records',        'records', '{:>7}'),
+    ('played_s',       'secs',    '{:>6.1f}'),
+    ('packets_per_s',  'pkt/s',   '{:>7.1f}'),
+    ('bytes_in',       'B->ard',  '{:>8}'),
+    ('bytes_out',      'B<-ard',  '{:>8}'),
+    ('queue_mean',     'q mean',  '{:>6.1f}'),
+    ('queue_max',      'q max',   '{:>5}'),
+    ('slack_min_ms',   'slk min', '{:>7.1f}'),
+    ('slack_median_ms', 'slk med', '{:>7.1f}'),
+    ('missed',         'missed',  '{:>6}'),
+    ('late',           'late',    '{:>5}'),
+    ('nacks',          'nacks',   '{:>5}'),
+]
+
+def song_names(songs_dir: str) -> list:
+    return sorted(os.path.splitext(f)[0] for f in os.listdir(songs_dir) if f.endswith('.json'))
+
+def bench_song(name: str, songs_dir: str, seconds: float | None, use_pty: bool,
+               max_baud: int | None = None) -> dict:
+    """
+    Play one song on a fresh simulated board and return its figures.
+    """
+    sim = simulator.SimulatedArduino()
+    if use_pty:
+        port = simulator.serve_pty(sim)
+    else:
+        port = 'sim'
+        scheduler.connect = lambda port, baud: sim    # Hand the simulator to the session.
+    bauds   = tuple(b for b in scheduler.LINK_BAUDS if max_baud is None or b <= max_baud)
+    session = scheduler.SerialSession(port, link_bauds=bauds)
+    song    = songcompiler.load_song(name, songs_dir)
+    try:
+        session.open()
+        sim.stats = simulator.SimStats()             # Count the song, not the handshake.
+        player = threading.Thread(target=scheduler.play_song, args=(name, songs_dir),
+                                  kwargs={'session': session}, daemon=True)
+        t0 = time.monotonic()
+        player.start()
+        player.join(seconds)
+        if player.is_alive():
+            scheduler.stop_song(session)
+            player.join()
+        wall = time.monotonic() - t0
+        link_nacks = session.link.nacks if session.link else 0
+    finally:
+        session.close()
+        sim.close()
+
+    s = sim.stats.to_dict()
+    played = s['song_us'] / 1e6 if s['song_us'] else wall
+    ms = lambda us: None if us is None else us / 1000.0
+    return {
+        'song':            name,
+        'records':         song.count,
+        'played_s':        round(played, 2),
+        'packets':         s['packets'],
+        'packets_per_s':   round(s['packets'] / wall, 1) if wall else 0.0,
+        'bytes_in':        s['bytes_in'],
+        'bytes_out':       s['bytes_out'],
+        'queue_mean':      s['queue_mean'],
+        'queue_max':       s['queue_max'],
+        'slack_min_ms':    ms(s['slack_min_us']),
+        'slack_p5_ms':     ms(s['slack_p5_us']),
+        'slack_median_ms': ms(s['slack_median_us']),
+        'missed':          s['missed'],
+        'late':            s['late'],
+        'max_late_ms':     ms(s['max_late_us']),
+        'nacks':           link_nacks,
+        'rejected':        s['rejected'],
+        'by_type':         s['by_type'],
+    }
+
+def print_table(results: list) -> None:
+    width = max([len(r['song']) for r in results] + [4])
+    print(f"{'song':<{width}}  " + " ".join(f"{h:>{len(f.format(0))}}" for _, h, f in COLUMNS))
+    for r in results:
+        cells = []
+        for key, _, fmt in COLUMNS:
+            v = r.get(key)
+            cells.append(fmt.format(v) if v is not None else '-'.rjust(len(fmt.format(0))))
+        print(f"{r['song']:<{width}}  " + " ".join(cells))
+
+def print_compare(results: list, baseline: list) -> None:
+    """
+    Print the change in each figure against an earlier --json file.
+    """
+    before = {r['song']: r for r in baseline}
+    print("\nchange vs baseline:")
+    for r in results:
+        old = before.get(r['song'])
+        if old is None:
+            continue
+        diffs = []
+        for key, head, _ in COLUMNS[2:]:
+            a, b = old.get(key), r.get(key)
+            if isinstance(a, (int, float)) and isinstance(b, (int, float)) and a != b:
+                diffs.append(f"{head} {b - a:+.1f}")
+        print(f"  {r['song']}: " + (", ".join(diffs) if diffs else "no change"))
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description="Replay songs through a simulated Arduino.")
+    ap.add_argument('--songs', nargs='+', help="song names (default: every song)")
+    ap.add_argument('--songs-dir', default=songcompiler.SONGS_DIR)
+    ap.add_argument('--seconds', type=float, help="stop each song after this many seconds")
+    ap.add_argument('--json', help="write the results to this file")
+    ap.add_argument('--compare', help="results file from an earlier run to compare against")
+    ap.add_argument('--fail-on-miss', action='store_true', help="exit 1 if any note arrived late")
+    ap.add_argument('--max-baud', type=int, help="negotiate no faster link rate than this")
+    ap.add_argument('--pty', action='store_true', help="run through a pseudo-terminal and pyserial")
+    args = ap.parse_args()
+
+    scheduler.DEBUG = False
+    results = []
+    for name in args.songs or song_names(args.songs_dir):
+        results.append(bench_song(name, args.songs_dir, args.seconds, args.pty, args.max_baud))
+    print_table(results)
+    if args.compare:
+        with open(args.compare) as f:
+            print_compare(results, json.load(f))
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(results, f, indent=2)
+    if args.fail_on_miss and any(r['missed'] for r in results):
+        return 1
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""
+clocksync.py
+
+
+NTP-style estimate of the Arduino's micros() clock against the Pi's
+monotonic clock. All times here are in microseconds.
+
+Each probe records the Pi send time t0, the Arduino's timestamp a and the Pi
+receive time t3. Within a burst only the lowest-RTT probe is kept, since it
+suffered the least queueing on the USB link; its midpoint (t0 + t3) / 2 is
+paired with a. A least-squares line through those points gives the offset
+and skew of the Arduino clock, and the skew becomes the rate correction the
+Arduino applies to its song clock.
+
+micros() wraps every ~71 minutes; timestamps are unwrapped as they arrive so
+the fit always sees a continuous clock. Values sent back to the Arduino are
+reduced modulo 2^32 by the caller.
+"""
+
+import time                                          # Monotonic Pi clock.
+
+# --- Configuration ------------------------------------------------------------
+
+PROBES_PER_BURST = 8                                 # Probes sent per measurement.
+MAX_POINTS       = 32                                # Burst results kept for the fit.
+RTT_SLACK_US     = 2000.0                            # Points slower than best RTT + slack are dropped.
+MIN_SPAN_US      = 1000000.0                         # Time spread needed before estimating skew.
+WRAP             = 1 << 32                           # micros() period.
+STALE_US         = 30 * 60 * 1e6                     # Older points are discarded (and can't be unwrapped).
+
+def pi_now_us() -> float:
+    """
+    Pi timebase used for every clock measurement.
+    """
+    return time.monotonic() * 1000000.0
+
+class ClockSync:
+    """
+    Running fit of arduino_us = offset + (1 + skew) * pi_us.
+    """
+    def __init__(self):
+        self.points = []                             # (pi_mid_us, arduino_us unwrapped, rtt_us).
+        self._wraps = 0                              # micros() rollovers seen so far.
+        self._last  = None                           # Last raw micros() value.
+
+    def add_burst(self, samples: list) -> bool:
+        """
+        Add the best of one burst of (t0, arduino micros(), t3) samples.
+        Returns False if the burst had no usable sample.
+        """
+        if not samples:
+            return False
+        t0, a, t3 = min(samples, key=lambda s: s[2] - s[0])
+        if self.points and t0 - self.points[-1][0] > STALE_US:
+            self.points = []                         # Idle too long: start a fresh fit.
+            self._wraps = 0
+            self._last  = None
+        if self._last is not None and a < self._last and self._last - a > WRAP // 2:
+            self._wraps += 1                         # micros() rolled over since the last burst.
+        self._last = a
+        self.points.append(((t0 + t3) / 2.0, float(a + self._wraps * WRAP), t3 - t0))
+        self.points = self.points[-MAX_POINTS:]
+        return True
+
+    def _good_points(self) -> list:
+        best = min(p[2] for p in self.points)
+        return [p for p in self.points if p[2] <= best + RTT_SLACK_US]
+
+    def fit(self) -> tuple:
+        """
+        Return (offset_us, skew) of the Arduino clock relative to the Pi's.
+        Skew stays 0 until two points far enough apart exist.
+        """
+        pts = self._good_points()
+        x0 = pts[-1][0]                              # Centre x to keep the sums small.
+        n  = len(pts)
+        mx = sum(p[0] - x0 for p in pts) / n
+        my = sum(p[1] for p in pts) / n
+        if pts[-1][0] - pts[0][0] < MIN_SPAN_US:     # Too close together for a slope.
+            p = pts[-1]
+            return p[1] - p[0], 0.0
+        sxx = sum((p[0] - x0 - mx) ** 2 for p in pts)
+        sxy = sum((p[0] - x0 - mx) * (p[1] - my) for p in pts)
+        slope = sxy / sxx
+        offset = my - slope * (mx + x0)
+        return offset, slope - 1.0
+
+    def to_arduino(self, pi_us: float) -> float:
+        offset, skew = self.fit()
+        return offset + (1.0 + skew) * pi_us
+
+    def to_pi(self, arduino_us: float) -> float:
+        # arduino_us is on the unwrapped scale used by self.points.
+        offset, skew = self.fit()
+        return (arduino_us - offset) / (1.0 + skew)
+
+    def rate_ppm(self) -> int:
+        """
+        Rate the Arduino song clock must run at, relative to its micros(),
+        to keep pace with the Pi: song = local / (1 + skew).
+        """
+        _, skew = self.fit()
+        return int(round((1.0 / (1.0 + skew) - 1.0) * 1e6))
+
+    def best_rtt(self) -> float:
+        return min(p[2] for p in self.points)
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""
+events.py
+
+
+Server-sent event fan-out for the web UI: playback code publishes, and
+every open /events stream gets its own copy.
+
+Each subscriber has a small queue. A slow client loses its oldest
+undelivered events rather than holding up the playback thread, which
+only ever appends; the next progress event supersedes a lost one anyway.
+"""
+
+import json                                          # Event payloads.
+import queue                                         # Per-client hand-off.
+import threading                                     # Subscriber set guard.
+
+# --- Configuration ------------------------------------------------------------
+
+CLIENT_QUEUE   = 64                                  # Events kept for a client that falls behind.
+KEEPALIVE_S    = 15.0                                # Idle time before a comment line keeps proxies open.
+RETRY_MS       = 2000                                # Browser reconnect delay after a dropped stream.
+
+class EventHub:
+    """
+    Publish (event, data) pairs to every subscriber. The last event of each
+    kind is kept, so a client that connects mid-song starts from the
+    current state instead of waiting for the next change.
+    """
+    def __init__(self):
+        self.lock    = threading.Lock()
+        self.clients = set()                         # One queue per open stream.
+        self.latest  = {}                            # event -> last data published.
+
+    def publish(self, event: str, data: dict) -> None:
+        with self.lock:
+            self.latest[event] = data
+            clients = list(self.clients)
+        for q in clients:
+            while True:
+                try:
+                    q.put_nowait((event, data))
+                    break
+                except queue.Full:
+                    try:
+                        q.get_nowait()               # Drop the oldest for this client.
+                    except queue.Empty:
+                        pass
+
+    def forget(self, event: str) -> None:
+        # Stop replaying an event to new clients (e.g. progress after a song).
+        with self.lock:
+            self.latest.pop(event, None)
+
+    def stream(self):
+        """
+        Generator of text/event-stream chunks for one client, starting with
+        the latest of each event. Runs until the client disconnects.
+        """
+        q = queue.Queue(CLIENT_QUEUE)
+        with self.lock:
+            self.clients.add(q)
+            backlog = list(self.latest.items())
+        try:
+            yield f"retry: {RETRY_MS}\n\n"
+            for event, data in backlog:
+                yield format_event(event, data)
+            while True:
+                try:
+                    event, data = q.get(timeout=KEEPALIVE_S)
+                except queue.Empty:
+                    yield ": keep-alive\n\n"
+                    continue
+                yield format_event(event, data)
+        finally:
+            with self.lock:
+                self.clients.discard(q)
+
+def format_event(event: str, data: dict) -> str:
+    return f"event: {event}\ndata: {json.dumps(data, separators=(',', ':'))}\n\n"
@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""
+library.py
+
+
+Index of the song library for the web UI.
+
+Each song's entry holds what the touchscreen shows before a song is
+played: duration, starting BPM, strings and servos used, chord set and
+validation status. Entries come from the compiled song's SongAnalysis,
+so a song is only compiled when its file (or calibration.json) changed
+since the last scan, and the index is kept on disk so a restart does not
+recompile the whole library:
+
+    cache/library.json   {"version": n, "calibration": [mtime_ns, size],
+                          "songs": {name: {"stat": [mtime_ns, size], "meta": {...}}}}
+
+songs() answers from memory. The songs directory is rescanned (one stat
+per file) at most every RESCAN_INTERVAL seconds, so adding or editing a
+song shows up within that time without any request paying for a scan.
+"""
+
+import json                                          # Index file.
+import os                                            # Filesystem operations.
+import threading                                     # Guards the index across requests.
+import time                                          # Rescan throttle.
+
+import scheduler                                     # Calibration path.
+import songcompiler                                  # Compiled songs and their analysis.
+
+# --- Configuration ------------------------------------------------------------
+
+INDEX_NAME      = 'library.json'                     # Index file inside the cache directory.
+RESCAN_INTERVAL = 2.0                                # Seconds between directory rescans.
+
+def _stat_key(path: str) -> list:
+    # What decides whether an entry is current: mtime and size.
+    st = os.stat(path)
+    return [st.st_mtime_ns, st.st_size]
+
+def song_meta(name: str, songs_dir: str, cache_dir: str) -> dict:
+    """
+    Library entry for one song, compiling it if no cached copy is current.
+    """
+    try:
+        with songcompiler.load_song(name, songs_dir, cache_dir) as song:
+            a = song.analysis
+    except Exception as e:
+        return {'name': name, 'status': 'error', 'error': str(e)}
+    return {
+        'name':       name,
+        'length_ms':  a.length_ms,
+        'bpm':        a.bpm,
+        'strings':    a.strings,
+        'servos':     [int(s) for s in a.servo_moves],
+        'chords':     a.chords,
+        'sections':   len(a.sections),
+        'events':     a.events,
+        'peak_per_s': a.peak_per_s,
+        'conflicts':  a.conflicts,
+        'status':     'conflicts' if a.conflicts else 'ok',
+    }
+
+class SongLibrary:
+    """
+    Incrementally maintained index of every song in songs_dir.
+    """
+    def __init__(self, songs_dir: str = songcompiler.SONGS_DIR,
+                 cache_dir: str = songcompiler.CACHE_DIR,
+                 calibration_path: str = scheduler.CALIBRATION_PATH):
+        self.songs_dir        = songs_dir
+        self.cache_dir        = cache_dir
+        self.calibration_path = calibration_path
+        self.lock             = threading.Lock()
+        self._entries         = {}                   # name -> {"stat", "meta"}.
+        self._listing         = []                   # Sorted metadata, as served.
+        self._calibration     = None
+        self._scanned_at      = None                 # time.monotonic() of the last scan.
+        self._load_index()
+
+    def _index_path(self) -> str:
+        return os.path.join(self.cache_dir, INDEX_NAME)
+
+    def _load_index(self) -> None:
+        try:
+            with open(self._index_path()) as f:
+                data = json.load(f)
+        except (OSError, ValueError):
+            return
+        if data.get('version') == songcompiler.FORMAT_VERSION:
+            self._entries     = data.get('songs', {})
+            self._calibration = data.get('calibration')
+
+    def _save_index(self) -> None:
+        os.makedirs(self.cache_dir, exist_ok=True)
+        tmp = self._index_path() + '.tmp'
+        with open(tmp, 'w') as f:
+            json.dump({'version': songcompiler.FORMAT_VERSION, 'calibration': self._calibration,
+                       'songs': self._entries}, f)
+        os.replace(tmp, self._index_path())          # Never leave a half-written index.
+
+    def refresh(self, force: bool = False) -> None:
+        """
+        Rescan the library if RESCAN_INTERVAL has passed (or force), and
+        rebuild entries for songs that are new or changed.
+        """
+        with self.lock:
+            now = time.monotonic()
+            if not force and self._scanned_at is not None \
+                    and now - self._scanned_at < RESCAN_INTERVAL:
+                return
+            self._scanned_at = now
+
+            calibration = _stat_key(self.calibration_path)
+            stale_all   = calibration != self._calibration
+            entries     = {}
+            for entry in os.scandir(self.songs_dir):
+                if not entry.name.endswith('.json') or not entry.is_file():
+                    continue
+                name = entry.name[:-5]
+                info = entry.stat()
+                st   = [info.st_mtime_ns, info.st_size]
+                old  = self._entries.get(name)
+                if old is not None and old['stat'] == st and not stale_all:
+                    entries[name] = old
+                else:
+                    entries[name] = {'stat': st,
+                                     'meta': song_meta(name, self.songs_dir, self.cache_dir)}
+            changed = entries != self._entries or stale_all
+            self._entries     = entries
+            self._calibration = calibration
+            self._listing     = sorted((e['meta'] for e in entries.values()),
+                                       key=lambda m: m['name'].casefold())
+            if changed:
+                self._save_index()
+
+    def songs(self) -> list:
+        """
+        Metadata for every song, sorted by name.
+        """
+        self.refresh()
+        return self._listing
+
+    def get(self, name: str) -> dict | None:
+        self.refresh()
+        entry = self._entries.get(name)
+        return entry['meta'] if entry else None
+
+if __name__ == '__main__':
+    # Build the index and print it: python3 library.py
+    lib = SongLibrary()
+    lib.refresh(force=True)
+    for m in lib.songs():
+        if m['status'] == 'error':
+            print(f"{m['name']}: error: {m['error']}")
+            continue
+        print(f"{m['name']}: {m['length_ms'] / 1000:.1f} s at {m['bpm']:g} BPM, "
+              f"strings {''.join(m['strings']) or '-'}, chords {', '.join(m['chords']) or '-'}, "
+              f"{m['status']}")
@@ -12,57 +12,135 @@ import time                                          # Timing functions.
 import struct                                        # Binary data packing/unpacking.
 import json                                          # JSON parsing for song files.
 import threading                                     # Threading primitives for cancellation.
+import queue                                         # Hand-off of replies from the reader thread.
+import os                                            # Random bytes for baud-rate echo checks.
+import zlib                                          # Stored-song ids.
+import bisect                                        # Record index for a song time.
+
+import clocksync                                     # Pi/Arduino clock offset and drift estimate.
+import telemetry                                     # Decoder for binary debug records.
+import tempomap                                      # Beat -> us mapping with tempo changes.
 
 # --- Configuration ------------------------------------------------------------
 
 DEBUG          = True                                # Enable detailed debug output.
 SERIAL_PORT    = '/dev/ttyACM0'                      # Path to Arduino serial port.
-BAUD_RATE      = 115200                              # Serial communication speed.
-BPM            = 120                                 # Beats per minute tempo.
-ms_per_beat    = 60000.0 / BPM                       # Milliseconds duration of one beat.
+BAUD_RATE      = 115200                              # Serial speed the link starts (and falls back) at.
+LINK_BAUDS     = (1000000, 500000, 250000)           # Faster rates to negotiate, best first; () disables.
+BAUD_ECHO_TIMEOUT = 0.2                              # Seconds a new rate's echo may take.
+BAUD_TRIAL_S   = 1.0                                 # Arduino's BAUD_TRIAL_MS: it reverts after this.
+FALLBACK_NACKS = 5                                   # NACKs within FALLBACK_WINDOW that step the rate down.
+FALLBACK_WINDOW = 10.0                               # Seconds over which NACKs are counted.
+BPM            = 120                                 # Tempo of songs that do not set one (see tempomap.py).
 SYNC_DELAY_MS  = 1000                                # Delay before first action for sync.
 END_SLACK      = 1500                                 # Extra ms to ensure final action completes.
-WINDOW_MS      = 10000                               # Rolling window size, 10 seconds
-CHECK_INTERVAL = 1                                   # Seconds between scheduler checks
+READ_TIMEOUT   = 0.05                                # Seconds the reader thread blocks per read.
+RESYNC_INTERVAL = 10.0                               # Seconds between clock re-measurements in playback.
+PROGRESS_INTERVAL = 0.25                             # Seconds between progress callbacks without news.
+HANDSHAKE_TIMEOUT = 5.0                              # Seconds to wait for the board after opening the port.
+
+# Framing (see RemoteControl.h): every packet goes out as
+# FLAG, escaped(seq, type, payload, crc8), FLAG. Bytes equal to FLAG, ESC or
+# STOP_MARKER are sent as ESC, byte ^ ESC_XOR, so a STOP burst is never
+# mistaken for frame data.
+FRAME_FLAG      = 0x7E                               # Frame delimiter.
+FRAME_ESC       = 0x7D                               # Escape prefix.
+FRAME_ESC_XOR   = 0x20                               # Applied to an escaped byte.
+CRC8_POLY       = 0x07                               # CRC-8, init 0, no final XOR.
+FRAME_HISTORY   = 64                                 # Sent frames kept for resending on NACK.
+NACK_HOLDOFF    = 0.02                               # Seconds a repeated NACK for one frame is ignored.
+LINK_RESET_MARKER = 0xA0                             # Restarts the Arduino's sequence count.
+CAPS_MARKER     = 0xA1                               # Asks for "CAPS:<rate> <rate>...".
+BAUD_MARKER     = 0xA2                               # Switch serial rate: rate u32 LE.
+ECHO_MARKER     = 0xA3                               # Answered with "ECHO:<payload hex>".
+STATS_MARKER    = 0xA4                               # Timing counters: flags u8 (1 = clear after).
+STATS_TIMEOUT   = 0.3                                # Seconds to wait for the binary reply.
 
-# Packet markers matching Arduino definitions.
+# Packet types matching Arduino definitions; a packet is a (type, payload) pair.
 SYNC_MARKER     = 0xAA                               # Marker for sync packet.
-SYNC_TYPE       = 0x01                               # Expected type within sync packet.
+SYNC_TYPE       = 0x02                               # Sync packet type; 0x02 means all times are in us.
+STORE_BEGIN_MARKER = 0xB0                            # Start a song upload: id u32, count u16, end us u32.
+STORE_DATA_MARKER  = 0xB1                            # index u16 + up to MAX_BATCH_RECORDS stored records.
+STORE_END_MARKER   = 0xB2                            # Finish an upload: crc8 over every record byte.
+STORE_QUERY_MARKER = 0xB3                            # Asks for "STORED:<id hex> <count> <capacity>".
+PLAY_STORED_MARKER = 0xB4                            # Play the stored song: start u32, from us u32.
 COMMAND_MARKER  = 0xBB                               # Marker for pick/command packets.
-GET_TIME_MARKER = 0xCC                               # Marker to request Arduino time.
+BATCH_MARKER    = 0xBC                               # Marker for multi-command batch packets.
+GET_TIME_MARKER = 0xCC                               # Marker for a clock probe.
+TIME_REPLY      = 0xCD                               # Binary probe reply: id(1) + micros u32 LE.
+CLOCK_ADJ_MARKER = 0xCE                              # Marker for a drift-correction packet.
+CALIBRATE_MARKER = 0xC0                              # Marker for a per-servo pulse range upload.
+PULSE_MARKER    = 0xC1                               # Marker for an immediate raw pulse-count move.
+POSE_DEFINE_MARKER = 0xC2                            # Marker for a pose register upload.
 END_MARKER      = 0xDD                               # Marker signalling end-of-song.
 STOP_MARKER     = 0xEE                               # Marker to stop all Arduino actions.
+STOP_BURST_LEN  = 8                                  # STOP bytes sent so the Arduino sees them mid-packet.
 RESET_MARKER    = 0xEF                               # Marker to reset servos to neutral positions.
 
+CREDIT_REPORT_STEP = 8                               # Arduino's: commands run between FREE reports.
+MAX_BATCH_RECORDS = 11                               # Records per BATCH (fits Arduino's 64-byte frame buffer).
+MAX_BATCH_OFFSET  = 0xFFFFFF                         # Largest per-record us offset from the batch base.
+STORE_RECORD_SIZE = 5                                # Stored record: target, angle, delta u24.
+MAX_STORE_DELTA   = 0xFFFFFF                         # Largest gap between stored records (us).
+STORE_REPLY_TIMEOUT = 1.0                            # Seconds one upload packet may take (EEPROM ~3.4 ms/byte).
+MAX_DELAY_US      = 0x7FFFFFFF                       # Arduino song clock is signed 32-bit us (~35 min).
+MAX_POSES         = 16                               # Pose registers on the Arduino.
+POSE_TARGET_BASE  = 0x80                             # Command target that triggers pose 0.
+POSE_UNCHANGED    = 0xFF                             # Pose angle that leaves a servo alone.
+
 # Load calibration data
-with open("calibration.json", "r") as f:
+CALIBRATION_PATH = "calibration.json"                # Servo angles used to build commands.
+with open(CALIBRATION_PATH, "r") as f:
     calibration = json.load(f)
 
-# --- Cancellation support -----------------------------------------------------
+# Controllers, one per Arduino (see Ensemble). Each plays the song servos in
+# its range, renumbered by subtracting offset to match its sketch's
+# servoMap: e.g. picks (0, 5) on one board and frets (6, 17),
+# offset 6, on another, or a second guitar as (18, 35), offset 18. Pose
+# triggers go to every board, whose pose registers hold only its own
+# servos. One entry plays the whole song.
+DEVICES = [
+    {'port': SERIAL_PORT, 'servos': (0, 17), 'offset': 0},
+]
 
-stop_event = threading.Event()                       # Event flag to request song stop.
+# --- Cancellation support -----------------------------------------------------
 
-def stop_song() -> None:
+def stop_song(session: "SerialSession | None" = None, timeout: float = 0.5) -> float | None:
     """
-    Signal running play_song() to halt, and send STOP+RESET to Arduino.
+    Signal the play_song() running on a session to halt and send a STOP
+    burst to its Arduino (the playback thread keeps using the link too).
+
+    The Arduino acts on the burst even behind a half-received packet,
+    clears its queue and moves every servo to the neutral pose (pose 0) in
+    one burst. Returns the measured send-to-STOPPED latency in ms, or None
+    if STOPPED did not arrive in time.
     """
-    stop_event.set()
+    session = session or get_session()
+    session.stop_event.set()
     try:
-        ser = connect()
-        # Send STOP first
-        ser.write(bytes([STOP_MARKER]))
+        link = session.open()
+        link.stopped.clear()
+        t0 = time.monotonic()
+        link.write(bytes([STOP_MARKER]) * STOP_BURST_LEN)
         if DEBUG:
-            print("[stop] Sent STOP_MARKER (0xEE)")
-        time.sleep(0.02)  # Give Arduino time to clear state
-        # Now send dynamic RESET
-        send_reset(ser, calibration)
-        ser.close()
+            print(f"[stop] Sent STOP burst ({STOP_BURST_LEN} x 0xEE)")
+        latency = None
+        if link.stopped.wait(timeout):
+            latency = (time.monotonic() - t0) * 1000.0
+            if DEBUG:
+                print(f"[stop] STOPPED after {latency:.1f} ms")
+        session.record_stop(latency)
+        if not session.registers_uploaded():
+            # Pose 0 is unknown to the board yet: send the angles explicitly.
+            send_reset(link, calibration)
+        return latency
     except Exception as e:
         print(f"[stop] Could not send STOP/RESET to Arduino: {e}")
+        return None
     
-def send_reset(ser, calibration):
+def neutral_angles(calibration) -> list:
     """
-    Send RESET packet with all neutral servo angles (int16, big-endian).
+    Neutral angle of every servo, in Arduino index order.
     """
     # The order here must match your Arduino's indices: 0-5 picking, 6-17 fretting
     # Picking servos: 'e', 'A', 'D', 'G', 'B', 'E' (indices 0-5)
@@ -72,22 +150,56 @@ def send_reset(ser, calibration):
     fret_indices = [6,7,8,9,10,11,12,13,14,15,16,17]
     fret_strings = ['e','A','D','G','B','E','e','A','D','G','B','E']
     angles.extend([int(calibration['fretting'][s]['neutral'][str(idx)]) for s, idx in zip(fret_strings, fret_indices)])
+    return angles
 
-    # Build packet: [0xEF][angle0][angle1]...[angle17], each angle as int16 big-endian
-    pkt = bytearray([RESET_MARKER])
+def send_reset(link: "ArduinoLink", calibration, timeout: float = 0.5) -> bool:
+    """
+    Send RESET packet with all neutral servo angles (int16, big-endian).
+    The Arduino also keeps these angles as pose 0.
+    Returns True once RESET_DONE arrives, False on timeout.
+    """
+    angles = neutral_angles(calibration)
+
+    # Payload: [angle0][angle1]...[angle17], each angle as int16 big-endian
+    payload = bytearray()
     for angle in angles:
-        pkt += angle.to_bytes(2, byteorder='big', signed=True)
-    ser.write(pkt)
+        payload += angle.to_bytes(2, byteorder='big', signed=True)
+    link.reset_done.clear()
+    link.send((RESET_MARKER, bytes(payload)))
     if DEBUG:
         print(f"[reset] Sent RESET packet: {angles}")
-    # Wait for Arduino ack
-    time.sleep(0.05)
-    while ser.in_waiting:
-        line = ser.readline().decode('utf-8','replace').strip()
-        if "RESET_DONE" in line:
-            if DEBUG:
-                print("From Arduino:", line)
-            break
+    # Wait for Arduino ack (seen by the link's reader thread)
+    return link.reset_done.wait(timeout)
+
+NUM_SERVOS = 18                                      # Picking 0-5, fretting 6-17.
+
+def pulse_range(servo: int) -> tuple:
+    """
+    Pulse widths (us) a servo sweeps from 0 to 180 degrees. calibration.json
+    may override the "default" range per servo index under "pulse_us".
+    """
+    ranges = calibration.get("pulse_us", {})
+    r = ranges.get(str(servo), ranges.get("default", {"min": 400, "max": 2600}))
+    return int(r["min"]), int(r["max"])
+
+def calibration_packets(pairs: list | None = None) -> list:
+    """
+    CALIBRATE packets for every servo: [0xC0][servo][min us u16 LE][max us u16 LE].
+    The Arduino turns each range into its angle-to-count table once.
+    pairs maps (board servo, calibrated servo); by default every servo is itself.
+    """
+    pairs = pairs if pairs is not None else [(servo, servo) for servo in range(NUM_SERVOS)]
+    return [(CALIBRATE_MARKER, struct.pack('<BHH', board, *pulse_range(servo)))
+            for board, servo in pairs]
+
+def send_pulse(link: "ArduinoLink", servo: int, count: int) -> None:
+    """
+    Move one servo straight to a PCA9685 pulse count (0-4095), bypassing the
+    angle conversion; handy for finding a servo's limits.
+    """
+    if not (0 <= count <= 4095):
+        raise ValueError("Pulse count must be in 0-4095")
+    link.send((PULSE_MARKER, struct.pack('<BH', servo & 0xFF, count)))
 
 # Maps indices to string names for picking servos
 INDEX_TO_STRING = {0: 'e', 1: 'A', 2: 'D', 3: 'G', 4: 'B', 5: 'E'}
@@ -97,56 +209,869 @@ INDEX_TO_STRING = {0: 'e', 1: 'A', 2: 'D', 3: 'G', 4: 'B', 5: 'E'}
 def connect(port: str = SERIAL_PORT, baud: int = BAUD_RATE) -> serial.Serial:
     """
     Open and initialise the serial connection to the Arduino.
+    DTR is held low so opening the port does not auto-reset the Mega where
+    the USB driver allows it; SerialSession waits for the board to answer
+    instead of sleeping a fixed time.
     """
-    ser = serial.Serial(port, baud, timeout=1)       # Open serial port with timeout.
+    ser = serial.Serial()                            # Configure before opening.
+    ser.port     = port
+    ser.baudrate = baud
+    ser.timeout  = 1
+    ser.dtr      = False                             # No reset pulse on open.
+    ser.open()
     ser.reset_input_buffer()                         # Flush any incoming data from buffer.
     ser.reset_output_buffer()                        # Clear any pending output data.
-    time.sleep(1)                                    # Give Arduino time to reboot.
     return ser                                       # Return the configured serial object.
 
-def get_arduino_time(ser: serial.Serial) -> int:
+def crc8(data: bytes) -> int:
     """
-    Request and return the current millis() from the Arduino.
+    CRC-8 as computed by the Arduino's frame receiver.
     """
-    ser.write(struct.pack('>B', GET_TIME_MARKER))    # Send single-byte time request.
-    while True:
-        line = ser.readline().decode('utf-8','replace').strip()  # Read response line.
-        if line.startswith("TIME:"):                  # Detect time response.
-            t = int(line.split("TIME:")[1])           # Parse milliseconds value.
-            if DEBUG:
-                print(f"[sync] Arduino time = {t} ms")  # Log received time.
-            return t                                  # Return the Arduino time.
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ CRC8_POLY) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
 
-def send_sync(ser: serial.Serial, start_time: int) -> None:
+def encode_frame(seq: int, pkt: tuple) -> bytes:
     """
-    Transmit the zero-reference time to synchronize schedules.
+    Frame one (type, payload) packet with its sequence number and CRC.
     """
-    pkt = struct.pack('>BBI', SYNC_MARKER, SYNC_TYPE, start_time)  # Create sync packet.
-    ser.write(pkt)                                      # Send sync instruction.
-    if DEBUG:
-        print(f"[sync] Sent SYNC @ {start_time} ms")   # Confirm sync transmission.
+    ptype, payload = pkt
+    body = bytes([seq & 0xFF, ptype]) + payload
+    body += bytes([crc8(body)])
+    out = bytearray([FRAME_FLAG])
+    for b in body:
+        if b in (FRAME_FLAG, FRAME_ESC, STOP_MARKER):
+            out += bytes([FRAME_ESC, b ^ FRAME_ESC_XOR])
+        else:
+            out.append(b)
+    out.append(FRAME_FLAG)
+    return bytes(out)
 
-def send_pick(ser: serial.Serial, target: int, angle: int, delay: int) -> None:
+def pack_batches(records: list) -> list:
     """
-    Send a pick command packet and handle Arduino debug output.
+    Pack (target, angle, delay) records into as few BATCH packets as possible.
+
+    Payload layout: [count][base u32 LE][count x (target, angle, offset u24 LE)];
+    the frame's CRC covers it. Delays are in microseconds. Records are
+    split into a new packet when one is full or an offset would not fit in
+    24 bits (~16.7 s).
+    Returns a list of ((BATCH_MARKER, payload), record count) pairs.
     """
-    if not (0 <= angle <= 180):
-        raise ValueError("Angle must be in 0-180 degrees")
-    if not (0 <= delay <= 0xFFFFFFFF):
-        raise ValueError("Delay must be in 0-4,294,967,295 ms")
-    pkt = struct.pack('<BBBI', COMMAND_MARKER, target & 0xFF, angle & 0xFF, delay) # Pack pick data.
-    ser.write(pkt)                                       # Transmit pick packet.
-    if DEBUG:
-        print(f"[pick] T={target} A={angle} D={delay} ms")  # Log command details.
+    packets = []
+    pending = sorted(records, key=lambda r: r[2])     # Base delay is the earliest record.
+    while pending:
+        base  = pending[0][2]
+        chunk = []
+        for rec in pending:
+            if len(chunk) == MAX_BATCH_RECORDS or rec[2] - base > MAX_BATCH_OFFSET:
+                break
+            chunk.append(rec)
+        pending = pending[len(chunk):]
+
+        body = bytearray(struct.pack('<BI', len(chunk), base))
+        for target, angle, delay in chunk:
+            if not (0 <= angle <= 180):
+                raise ValueError("Angle must be in 0-180 degrees")
+            if not (0 <= delay <= MAX_DELAY_US):
+                raise ValueError("Delay must be in 0-2,147,483,647 us")
+            body += struct.pack('<BB', target & 0xFF, angle & 0xFF) + (delay - base).to_bytes(3, 'little')
+        packets.append(((BATCH_MARKER, bytes(body)), len(chunk)))
+        if DEBUG:
+            print(f"[batch] N={len(chunk)} D={base} us: {chunk}")  # Log batch contents.
+    return packets
+
+def pack_stored(records) -> bytes | None:
+    """
+    Encode (abs_us, servo, angle) records as the Arduino's SongStore keeps
+    them: target, angle, then the us since the previous record as u24 LE.
+    Records must be in time order, as a compiled song is. None if a gap is
+    too long to encode (the song has to be streamed).
+    """
+    out  = bytearray()
+    prev = 0
+    for abs_us, servo, angle in records:
+        delta = abs_us - prev
+        if not (0 <= delta <= MAX_STORE_DELTA):
+            return None
+        out += struct.pack('<BB', servo & 0xFF, angle & 0xFF) + delta.to_bytes(3, 'little')
+        prev = abs_us
+    return bytes(out)
+
+class ArduinoLink:
+    """
+    Reader thread plus credit accounting for one open serial connection.
+
+    The Arduino reports "FREE:<free> <accepted>" whenever queue slots open up.
+    <accepted> counts commands it has buffered since SYNC; anything we sent
+    after that is still in flight, so the usable credit is
+    free - (sent - accepted). The writer blocks in reserve() until enough
+    credit exists, and the reader thread wakes it as soon as a report lands.
+
+    Packets are framed with a sequence number (see encode_frame). The last
+    FRAME_HISTORY frames are kept; "NACK:<seq>" makes the reader resend
+    from that frame on, in order, since the Arduino drops everything behind
+    a damaged frame. A NACK for a frame no longer kept restarts numbering
+    with a LINK_RESET (whatever it covered is lost, as without framing).
+    """
+    def __init__(self, ser: serial.Serial):
+        self.ser          = ser                          # Shared serial port.
+        self.write_lock   = threading.Lock()             # Serialises writers.
+        self.cond         = threading.Condition()        # Guards credit state below.
+        self.synced       = False                        # True once SYNCED has been seen.
+        self.free_slots   = 0                            # Last reported free slots.
+        self.accepted     = 0                            # Last reported accepted count.
+        self.sent         = 0                            # Commands sent since SYNC.
+        self.executed     = 0                            # Commands run since SYNC, as far as reported.
+        self.queue_size   = 0                            # Arduino queue capacity (free at SYNC).
+        self._tel_executed = 0                           # EXECUTED telemetry records since SYNC.
+        self.done         = threading.Event()            # Set when DONE arrives.
+        self.reset_done   = threading.Event()            # Set when RESET_DONE arrives.
+        self.stopped      = threading.Event()            # Set when STOPPED arrives.
+        self.time_replies = queue.Queue()                # (probe id, Arduino micros(), Pi receive us).
+        self.telemetry    = telemetry.Decoder()          # Arduino debug records.
+        self.tx_seq       = 0                            # Sequence number of the next frame.
+        self.history      = {}                           # seq -> frame bytes, newest FRAME_HISTORY.
+        self.nacks        = 0                            # NACKs received.
+        self.resent       = 0                            # Frames sent again after a NACK.
+        self._last_nack   = (None, 0.0)                  # (seq, monotonic time) last answered.
+        self.nack_times   = []                           # monotonic() of recent NACKs.
+        self.control      = queue.Queue()                # (kind, text) for CAPS/BAUD/ECHO/STORE replies.
+        self.stats_replies = queue.Queue()               # Decoded STATS replies.
+        self.stats_lock   = threading.Lock()             # One STATS query at a time.
+        self._closing     = threading.Event()
+        self._reader      = threading.Thread(target=self._read_loop, daemon=True)
+        ser.timeout       = READ_TIMEOUT                 # Short reads keep the reader responsive.
+        self._reader.start()
+
+    def alive(self) -> bool:
+        # False once the reader has stopped (port closed or unplugged).
+        return self._reader.is_alive() and not self._closing.is_set()
+
+    def close(self) -> None:
+        self._closing.set()
+        with self.cond:
+            self.cond.notify_all()
+        self._reader.join(timeout=1.0)
+
+    def write(self, raw: bytes) -> None:
+        # Unframed bytes; only the STOP burst is sent this way.
+        with self.write_lock:
+            self.ser.write(raw)
+
+    def send(self, pkt: tuple) -> None:
+        """
+        Frame and send one (type, payload) packet.
+        """
+        with self.write_lock:
+            seq   = self.tx_seq
+            frame = encode_frame(seq, pkt)
+            self.history[seq] = frame
+            self.history.pop((seq - FRAME_HISTORY) & 0xFF, None)
+            self.tx_seq = (seq + 1) & 0xFF
+            self.ser.write(frame)
+
+    def link_reset(self) -> None:
+        """
+        Make the Arduino count frames from this one on, forgetting any gap.
+        """
+        with self.write_lock:
+            self.history.clear()
+        self.send((LINK_RESET_MARKER, b''))
+
+    def _resend_from(self, seq: int) -> None:
+        # Reader thread: answer "NACK:<seq>". Frames already in flight when
+        # the Arduino sent one NACK can draw more for the same seq; the
+        # resend covers them.
+        now = time.monotonic()
+        with self.write_lock:
+            self.nacks += 1
+            self.nack_times = [t for t in self.nack_times if now - t < FALLBACK_WINDOW] + [now]
+            last_seq, last_t = self._last_nack
+            if seq == last_seq and now - last_t < NACK_HOLDOFF:
+                return
+            self._last_nack = (seq, now)
+            if seq not in self.history:
+                frames = None
+            else:
+                n = (self.tx_seq - seq) & 0xFF
+                frames = [self.history[(seq + i) & 0xFF] for i in range(n)]
+                self.resent += n
+                for frame in frames:
+                    self.ser.write(frame)
+        if frames is None:
+            if DEBUG:
+                print(f"[link] NACK for frame {seq}, no longer kept: restarting numbering")
+            self.link_reset()
+        elif DEBUG:
+            print(f"[link] NACK for frame {seq}: resent {len(frames)} frames")
+
+    def recent_nacks(self) -> int:
+        # NACKs within the last FALLBACK_WINDOW seconds.
+        now = time.monotonic()
+        with self.write_lock:
+            return sum(1 for t in self.nack_times if now - t < FALLBACK_WINDOW)
 
-    time.sleep(0.015)                                    # Short pause for buffer handling.
-    while ser.in_waiting:                                # Process any Arduino responses.
-        line = ser.readline().decode('utf-8','replace').strip()  # Read response line.
+    def _await_control(self, kind: str, timeout: float) -> str | None:
+        # Next reply of one kind from the reader thread, skipping others.
+        deadline = time.monotonic() + timeout
+        while True:
+            try:
+                k, text = self.control.get(timeout=max(0.0, deadline - time.monotonic()))
+            except queue.Empty:
+                return None
+            if k == kind:
+                return text
+
+    def _drain_control(self) -> None:
+        while not self.control.empty():
+            self.control.get_nowait()
+
+    def capabilities(self, timeout: float = 0.2) -> list:
+        """
+        Serial rates the Arduino supports; empty if it does not answer
+        (firmware without negotiation).
+        """
+        self._drain_control()
+        self.send((CAPS_MARKER, b''))
+        text = self._await_control("CAPS", timeout)
+        try:
+            return [int(x) for x in text.split()] if text else []
+        except ValueError:
+            return []
+
+    def echo(self, timeout: float = BAUD_ECHO_TIMEOUT) -> float | None:
+        """
+        Send random bytes for the Arduino to echo back; the round trip in
+        seconds, or None if the reply is missing or wrong.
+        """
+        data = os.urandom(16)
+        self._drain_control()
+        t0 = time.monotonic()
+        self.send((ECHO_MARKER, data))
+        text = self._await_control("ECHO", timeout)
+        if text is None or text.upper() != data.hex().upper():
+            return None
+        return time.monotonic() - t0
+
+    def set_baud(self, baud: int) -> None:
+        # Change the Pi end only, after everything queued has gone out.
+        with self.write_lock:
+            self.ser.flush()
+            self.ser.baudrate = baud
+
+    def switch_baud(self, baud: int) -> bool:
+        """
+        Move both ends to a new rate and verify it with a timed echo. On
+        failure the Pi end goes back and waits out the Arduino's trial, after
+        which it is back at the old rate too.
+
+        Other threads may keep sending meanwhile: frames caught on the wrong
+        side of the switch are garbage to the Arduino and get NACKed and
+        resent like any damaged frame.
+        """
+        old = self.ser.baudrate
+        self._drain_control()
+        self.send((BAUD_MARKER, struct.pack('<I', baud)))
+        if self._await_control("BAUD", 0.5) != str(baud):
+            return False                                 # Refused or unanswered: still at old.
+        time.sleep(0.002)                                # Arduino reopens its port.
+        self.set_baud(baud)
+        rtt = self.echo()
+        if rtt is None:
+            self.set_baud(old)
+            time.sleep(BAUD_TRIAL_S + 0.1)
+            self.link_reset()
+            if DEBUG:
+                print(f"[link] {baud} baud failed its echo, staying at {old}")
+            return False
+        if DEBUG:
+            print(f"[link] Switched to {baud} baud, echo {rtt * 1000:.2f} ms")
+        return True
+
+    def store_query(self, timeout: float = 0.2) -> tuple | None:
+        """
+        (id or None, count, capacity) of the Arduino's stored song; None if
+        it does not answer (firmware without a song store).
+        """
+        self._drain_control()
+        self.send((STORE_QUERY_MARKER, b''))
+        text = self._await_control("STORED", timeout)
+        try:
+            held, count, capacity = text.split()
+            return (None if held == 'none' else int(held, 16)), int(count), int(capacity)
+        except (AttributeError, ValueError):
+            return None
+
+    def store_song(self, song_id: int, data: bytes, end_us: int,
+                   cancel: threading.Event) -> bool:
+        """
+        Upload pack_stored() bytes as the stored song. Every packet waits
+        for its answer, since the Arduino blocks while it writes EEPROM.
+        False if the board refuses it, an answer is missing or the
+        read-back CRC fails; the board then holds no valid song.
+        """
+        count = len(data) // STORE_RECORD_SIZE
+        self._drain_control()
+        self.send((STORE_BEGIN_MARKER, struct.pack('<IHI', song_id & 0xFFFFFFFF, count, end_us)))
+        if self._await_control("STORE", STORE_REPLY_TIMEOUT) != "0":
+            return False
+        step = MAX_BATCH_RECORDS
+        for i in range(0, count, step):
+            if cancel.is_set():
+                return False
+            n = min(step, count - i)
+            self.send((STORE_DATA_MARKER, struct.pack('<H', i) + data[i * STORE_RECORD_SIZE:(i + n) * STORE_RECORD_SIZE]))
+            if self._await_control("STORE", STORE_REPLY_TIMEOUT) != str(i + n):
+                return False
+        self.send((STORE_END_MARKER, bytes([crc8(data)])))
+        text = self._await_control("STORED", STORE_REPLY_TIMEOUT + count * 0.001)
+        return bool(text) and text.split()[0] == f"{song_id & 0xFFFFFFFF:X}"
+
+    def play_stored(self, start_time: int, from_us: int = 0) -> bool:
+        """
+        Start the stored song so that song time from_us falls on Arduino
+        micros() start_time. Nothing more is streamed; DONE ends it as usual.
+        """
+        with self.cond:
+            self.synced = False                          # No credit: the board feeds itself.
+            self.done.clear()
+        self._drain_control()
+        self.send((PLAY_STORED_MARKER, struct.pack('<II', start_time & 0xFFFFFFFF, from_us)))
+        text = self._await_control("PLAYING", 0.2)
+        if DEBUG:
+            print(f"[sync] Sent PLAY_STORED @ {start_time} us from {from_us} us")
+        return text is not None and text != 'none'
+
+    def board_stats(self, clear: bool = False, timeout: float = STATS_TIMEOUT) -> dict | None:
+        """
+        The Arduino's timing counters (see telemetry.decode_stats), or None
+        if it does not answer (firmware without STATS). The reply is binary
+        and fits its TX buffer, so asking mid-song costs it no time.
+        """
+        with self.stats_lock:
+            while not self.stats_replies.empty():
+                self.stats_replies.get_nowait()
+            self.send((STATS_MARKER, bytes([1 if clear else 0])))
+            try:
+                return self.stats_replies.get(timeout=timeout)
+            except queue.Empty:
+                return None
+
+    def credit(self) -> int:
+        # Caller holds self.cond.
+        in_flight = (self.sent - self.accepted) & 0xFFFF
+        return self.free_slots - in_flight if self.synced else 0
+
+    def reserve(self, n: int, cancel: threading.Event) -> bool:
+        """
+        Block until n queue slots are available; False if cancelled first.
+        """
+        with self.cond:
+            while self.credit() < n:
+                if cancel.is_set() or self._closing.is_set():
+                    return False
+                self.cond.wait(READ_TIMEOUT)
+            self.sent = (self.sent + n) & 0xFFFF
+            return True
+
+    def send_records(self, records: list, cancel: threading.Event) -> bool:
+        """
+        Stream records as BATCH packets, each sent as soon as credit allows.
+        """
+        for pkt, n in pack_batches(records):
+            if not self.reserve(n, cancel):
+                return False
+            self.send(pkt)
+        return True
+
+    def send_end(self, end_rel: int, cancel: threading.Event) -> bool:
+        # end_rel is in us after sync, like every other delay.
+        if not self.reserve(1, cancel):                  # END occupies one queue slot.
+            return False
+        self.send((END_MARKER, struct.pack('<I', end_rel)))
+        return True
+
+    def sync(self, start_time: int) -> None:
+        """
+        Send SYNC and restart credit accounting; credit is granted by the
+        SYNCED / FREE reply that follows.
+        """
+        with self.cond:
+            self.synced = False
+            self.sent   = 0
+            self.executed = self.queue_size = self._tel_executed = 0
+            self.done.clear()
+        self.send((SYNC_MARKER, struct.pack('>BI', SYNC_TYPE, start_time)))
+        if DEBUG:
+            print(f"[sync] Sent SYNC @ {start_time} us")  # Confirm sync transmission.
+
+    def probe_burst(self, count: int = clocksync.PROBES_PER_BURST,
+                    timeout: float = 0.2) -> list:
+        """
+        Send count clock probes one after another and return the answered
+        ones as (Pi send us, Arduino micros(), Pi receive us) samples.
+        """
+        while not self.time_replies.empty():             # Drop stale replies.
+            self.time_replies.get_nowait()
+        samples = []
+        for probe in range(count):
+            t0 = clocksync.pi_now_us()
+            self.send((GET_TIME_MARKER, bytes([probe])))
+            deadline = time.monotonic() + timeout
+            while True:
+                try:
+                    pid, a, t3 = self.time_replies.get(timeout=max(0.0, deadline - time.monotonic()))
+                except queue.Empty:
+                    break                                # Lost probe: skip it.
+                if pid == probe:
+                    samples.append((t0, a, t3))
+                    break
+        if DEBUG and samples:
+            best = min(samples, key=lambda s: s[2] - s[0])
+            print(f"[sync] {len(samples)}/{count} probes, best RTT {(best[2] - best[0]) / 1000:.2f} ms")
+        return samples
+
+    def adjust_clock(self, ref_local: int, ref_song: int, rate_ppm: int) -> None:
+        """
+        Re-anchor the Arduino song clock: song time ref_song us at its
+        micros() ref_local, running rate_ppm faster than micros() from there.
+        """
+        self.send((CLOCK_ADJ_MARKER, struct.pack('<Iii', ref_local & 0xFFFFFFFF, ref_song, rate_ppm)))
+        if DEBUG:
+            print(f"[sync] Clock ref {ref_local & 0xFFFFFFFF} -> {ref_song} us, rate {rate_ppm} ppm")
+
+    def _read_loop(self) -> None:
+        buf = bytearray()
+        while not self._closing.is_set():
+            try:
+                chunk = self.ser.read(self.ser.in_waiting or 1)
+            except Exception as e:
+                if DEBUG:
+                    print(f"[link] Read failed: {e}")
+                break
+            if not chunk:
+                continue
+            buf += chunk
+            while buf:
+                if buf[0] == TIME_REPLY:                 # Binary probe reply.
+                    if len(buf) < 6:
+                        break
+                    pid, a = struct.unpack_from('<BI', buf, 1)
+                    self.time_replies.put((pid, a, clocksync.pi_now_us()))
+                    del buf[:6]
+                elif buf[0] == telemetry.STATS_REPLY:    # Binary timing counters.
+                    if len(buf) < telemetry.STATS.size:
+                        break
+                    self.stats_replies.put(telemetry.decode_stats(bytes(buf[:telemetry.STATS.size])))
+                    del buf[:telemetry.STATS.size]
+                elif buf[0] == telemetry.MARKER:         # Binary telemetry record.
+                    if len(buf) < telemetry.RECORD.size:
+                        break
+                    if buf[1] == telemetry.EXECUTED:     # Exact count while debugging.
+                        self._tel_executed += 1
+                        self.executed = max(self.executed, self._tel_executed)
+                    lines = self.telemetry.feed(bytes(buf[:telemetry.RECORD.size]))
+                    del buf[:telemetry.RECORD.size]
+                    if DEBUG:
+                        for line in lines:
+                            print("From Arduino:", line)
+                elif b'\n' in buf:                       # ASCII text line.
+                    raw, _, rest = buf.partition(b'\n')
+                    buf = bytearray(rest)
+                    self._handle_line(raw.decode('utf-8', 'replace').strip())
+                else:
+                    break
+
+    def _handle_line(self, line: str) -> None:
+        if not line:
+            return
+        if line.startswith("NACK:"):
+            try:
+                seq = int(line[5:]) & 0xFF
+            except ValueError:
+                return
+            self._resend_from(seq)
+            return
+        for kind in ("CAPS", "BAUD", "ECHO", "STORE", "STORED", "PLAYING"):
+            if line.startswith(kind + ":"):
+                self.control.put((kind, line[len(kind) + 1:].strip()))
+                if DEBUG:
+                    print("From Arduino:", line)
+                return
+        if line.startswith("FREE:"):
+            try:
+                free, accepted = line[5:].split()
+                free, accepted = int(free), int(accepted)
+            except ValueError:
+                return
+            with self.cond:
+                if self.synced:
+                    self.free_slots = free
+                    self.accepted   = accepted
+                    # Whatever was accepted and is no longer queued has run.
+                    self.queue_size = max(self.queue_size, free)
+                    self.executed   = max(self.executed, accepted - (self.queue_size - free))
+                    self.cond.notify_all()
+            return
         if DEBUG:
             print("From Arduino:", line)               # Output Arduino debug.
+        if line == "SYNCED":
+            with self.cond:
+                self.synced = True
+        elif line == "RESET_DONE":
+            self.reset_done.set()
+        elif line == "STOPPED":
+            self.stopped.set()
+        elif line == "DONE":
+            self.done.set()
+            with self.cond:
+                self.cond.notify_all()
+
+# --- Shared session -----------------------------------------------------------
+
+class SendSlack:
+    """
+    How far ahead of its deadline each streamed BATCH left the Pi: the
+    first (earliest) record's song time minus the song time at sending.
+    A batch sent with negative slack could only play late.
+    """
+    def __init__(self):
+        self.batches = 0                             # Batches timed since the session opened.
+        self.late    = 0                             # Of those, sent after their first deadline.
+        self.sum_us  = 0.0
+        self.min_us  = None                          # Smallest slack in the current song.
+
+    def start_song(self) -> None:
+        self.min_us = None
+
+    def add(self, slack_us: float) -> None:
+        self.batches += 1
+        self.sum_us  += slack_us
+        if slack_us < 0:
+            self.late += 1
+        if self.min_us is None or slack_us < self.min_us:
+            self.min_us = slack_us
+
+    def as_dict(self) -> dict:
+        return {
+            'batches': self.batches,
+            'late':    self.late,
+            'mean_ms': self.sum_us / self.batches / 1000.0 if self.batches else None,
+            'min_ms':  self.min_us / 1000.0 if self.min_us is not None else None,
+        }
+
+class SerialSession:
+    """
+    Long-lived, thread-safe connection to the Arduino.
+
+    The port is opened once and the handshake (board answering a clock
+    probe) runs once, so starting a song only costs the clock burst and
+    SYNC_DELAY_MS. Pulse ranges and pose registers are uploaded on first use
+    and again only when calibration changes. play_song, stop_song and status
+    queries all share the one ArduinoLink, whose write lock serialises their
+    packets. If the reader dies (cable pulled) the next open() reconnects.
+
+    A session is one board: it has its own stop_event, and plays the song
+    servos in its servos range (all of them unless it is part of an
+    Ensemble).
+    """
+    def __init__(self, port: str = SERIAL_PORT, baud: int = BAUD_RATE,
+                 link_bauds: tuple = LINK_BAUDS, servos: tuple = (0, NUM_SERVOS - 1),
+                 offset: int = 0):
+        self.port      = port
+        self.servos    = tuple(servos)               # Song servos this board plays, inclusive.
+        self.offset    = offset                      # Subtracted to give the board's own numbering.
+        self.stop_event = threading.Event()          # Set by stop_song() to end this board's song.
+        self.baud      = baud                        # Rate the link starts at.
+        self.link_bauds = link_bauds                 # Faster rates to try, best first.
+        self.link_baud = None                        # Rate in use while connected.
+        self.lock      = threading.RLock()           # Guards open/close/upload.
+        self.playing   = threading.Lock()            # Held by the running play_song().
+        self.ser       = None
+        self.link      = None
+        self.clock     = None                        # ClockSync kept across songs.
+        self.opened_at = None                        # time.time() of the last handshake.
+        self._uploaded = None                        # Last register upload sent.
+        self._stored   = None                        # (id, count, capacity) the board reported.
+        self.stop_latency_ms = None                  # Last measured STOP -> STOPPED time.
+        self.stop_timeouts   = 0                     # STOPs that were not acknowledged.
+        self.send_slack      = SendSlack()           # Streaming headroom, for /metrics.
+
+    def open(self) -> ArduinoLink:
+        """
+        Return the live link, connecting and handshaking first if needed.
+        """
+        with self.lock:
+            if self.link is not None and self.link.alive():
+                return self.link
+            self._close_locked()
+            self.ser  = connect(self.port, self.baud)
+            self.link = ArduinoLink(self.ser)
+            try:
+                self._handshake()
+            except Exception:
+                self._close_locked()
+                raise
+            return self.link
+
+    def _handshake(self) -> None:
+        # Probe until the board answers; after a reset its bootloader runs
+        # first, otherwise the first probe is answered within milliseconds.
+        # Each attempt restarts frame numbering, as a board that kept
+        # running since the last session still counts from where it was,
+        # and tries the next rate, as it may still be at a negotiated one.
+        rates    = [self.baud] + [b for b in self.link_bauds if b != self.baud]
+        deadline = time.monotonic() + HANDSHAKE_TIMEOUT
+        attempt  = 0
+        while True:
+            rate = rates[attempt % len(rates)]
+            attempt += 1
+            self.link.set_baud(rate)
+            self.link.link_reset()
+            if self.link.probe_burst(count=1, timeout=0.1):
+                break
+            if time.monotonic() > deadline:
+                raise TimeoutError(f"No answer from Arduino on {self.port}")
+        self.link_baud = rate
+        self._negotiate_baud()
+        self.clock = clocksync.ClockSync()
+        self.clock.add_burst(self.link.probe_burst())
+        self._uploaded = None                        # Board state is unknown after (re)connect.
+        self._stored   = self.link.store_query()     # Kept across power cycles, unlike registers.
+        self.opened_at = time.time()
+        if DEBUG:
+            print(f"[session] Connected to {self.port} @ {self.link_baud} baud")
+
+    def _negotiate_baud(self) -> None:
+        # Take the fastest rate both ends support that passes its echo.
+        caps = self.link.capabilities()
+        for rate in self.link_bauds:
+            if rate <= self.link_baud:
+                break
+            if rate in caps and self.link.switch_baud(rate):
+                self.link_baud = rate
+                return
+
+    def check_health(self) -> None:
+        """
+        Step down to the next slower rate when NACKs pile up at a negotiated
+        one. Safe during playback: frames sent across the switch are NACKed
+        and resent.
+        """
+        with self.lock:
+            link = self.link
+            if link is None or not link.alive() or self.link_baud == self.baud:
+                return
+            if link.recent_nacks() < FALLBACK_NACKS:
+                return
+            slower = [b for b in self.link_bauds if b < self.link_baud] + [self.baud]
+            if DEBUG:
+                print(f"[session] {link.recent_nacks()} NACKs at {self.link_baud} baud, stepping down")
+            for rate in slower:
+                if link.switch_baud(rate):
+                    self.link_baud = rate
+                    with link.write_lock:
+                        link.nack_times = []
+                    return
+            if DEBUG:
+                print(f"[session] No slower rate answered, staying at {self.link_baud} baud")
+
+    def upload_registers(self) -> None:
+        """
+        Send pulse ranges and pose registers if they differ from what the
+        board already holds (first use, or calibration.json changed).
+        """
+        pairs = self.board_servos()
+        poses = [{board: pose[servo] for board, servo in pairs if servo in pose}
+                 for pose in build_poses()]
+        data  = calibration_packets(pairs) + pose_packets(poses)
+        with self.lock:
+            link = self.open()
+            if data != self._uploaded:
+                for pkt in data:
+                    link.send(pkt)
+                self._uploaded = data
+
+    def store_song(self, song_id: int, records: list, end_us: int) -> bool:
+        """
+        Make a song part (see part()) the board's stored song, uploading it
+        only if the board holds a different one, so a replay starts at once.
+        False if it cannot be stored (no store, too long, or a gap too
+        wide); the caller streams it instead.
+
+        Called from play_song(), which holds self.playing; the session lock
+        is not held during the upload, so status queries are not delayed.
+        """
+        with self.lock:
+            link   = self.open()
+            stored = self._stored
+        if stored is None:
+            return False
+        held, _, capacity = stored
+        if held == song_id:
+            return True
+        data = pack_stored(records) if len(records) <= capacity else None
+        if data is None:
+            if DEBUG:
+                print(f"[store] {len(records)} records do not fit the board's store ({capacity})")
+            return False
+        t0 = time.monotonic()
+        ok = link.store_song(song_id, data, end_us, self.stop_event)
+        with self.lock:
+            self._stored = (song_id, len(records), capacity) if ok else (None, 0, capacity)
+        if DEBUG:
+            print(f"[store] Upload of {len(records)} records {'done' if ok else 'failed'} "
+                  f"in {time.monotonic() - t0:.1f} s")
+        return ok
+
+    def board_servos(self) -> list:
+        """
+        (board servo, calibrated servo) for every servo this board plays.
+        Song servo s is the board's s - offset and uses calibration.json's
+        servo s % NUM_SERVOS, so a second guitar numbered from 18 shares
+        the first one's calibration.
+        """
+        lo, hi = self.servos
+        return [(s - self.offset, s % NUM_SERVOS) for s in range(lo, hi + 1)]
+
+    def part(self, records) -> list:
+        """
+        The (abs_us, servo, angle) records this board plays: servos in its
+        range, renumbered, and every pose trigger.
+        """
+        lo, hi = self.servos
+        return [(t, servo - self.offset if servo < POSE_TARGET_BASE else servo, angle)
+                for t, servo, angle in records
+                if lo <= servo <= hi or servo >= POSE_TARGET_BASE]
+
+    def part_id(self, song) -> int:
+        # Stored-song id of this board's part of a compiled song.
+        return zlib.crc32(song.digest + struct.pack('<BBB', *self.servos, self.offset))
+
+    def registers_uploaded(self) -> bool:
+        with self.lock:
+            return self._uploaded is not None
+
+    def record_stop(self, latency_ms: float | None) -> None:
+        with self.lock:
+            if latency_ms is None:
+                self.stop_timeouts += 1
+            else:
+                self.stop_latency_ms = latency_ms
+
+    def _close_locked(self) -> None:
+        if self.link is not None:
+            self.link.close()
+        if self.ser is not None:
+            try:
+                self.ser.close()
+            except Exception:
+                pass
+        self.ser = self.link = self.clock = None
+        self.link_baud = None
+        self._uploaded = None
+        self._stored   = None
+
+    def close(self) -> None:
+        with self.lock:
+            self._close_locked()
+
+    def status(self) -> dict:
+        """
+        Connection details for status queries; never touches the port.
+        """
+        with self.lock:
+            connected = self.link is not None and self.link.alive()
+            rtt = None
+            if connected and self.clock is not None and self.clock.points:
+                rtt = self.clock.best_rtt() / 1000.0
+            return {
+                'connected':   connected,
+                'port':        self.port,
+                'baud':        self.link_baud if connected else None,
+                'since':       self.opened_at if connected else None,
+                'best_rtt_ms': rtt,
+                'stop_latency_ms': self.stop_latency_ms,
+                'stop_timeouts':   self.stop_timeouts,
+                'nacks':           self.link.nacks if connected else 0,
+                'frames_resent':   self.link.resent if connected else 0,
+            }
+
+    def metrics(self, clear: bool = False) -> dict:
+        """
+        status() plus the board's timing counters and the Pi's send slack;
+        clear restarts the board's counters after reading them. The board
+        is only asked if the port is already open.
+        """
+        info = self.status()
+        link = self.link
+        info['board'] = link.board_stats(clear) if info['connected'] and link is not None else None
+        info['send_slack'] = self.send_slack.as_dict()
+        return info
+
+_session: SerialSession | None = None                # Process-wide default session.
+_session_lock = threading.Lock()
+
+def get_session() -> SerialSession:
+    """
+    Return the default session for SERIAL_PORT, creating it on first use.
+    """
+    global _session
+    with _session_lock:
+        if _session is None:
+            _session = SerialSession()
+        return _session
+
+class Ensemble:
+    """
+    Several Arduinos (one SerialSession each, from DEVICES) playing one
+    song together; see play_song(sessions=...). Stop and status reach every
+    board at once.
+    """
+    def __init__(self, devices: list = DEVICES):
+        self.sessions = [SerialSession(d['port'], servos=d.get('servos', (0, NUM_SERVOS - 1)),
+                                       offset=d.get('offset', 0))
+                         for d in devices]
+
+    def open(self) -> None:
+        run_parallel(SerialSession.open, self.sessions)
+
+    def play(self, song_name: str, **kwargs) -> None:
+        play_song(song_name, sessions=self.sessions, **kwargs)
+
+    def stop(self, timeout: float = 0.5) -> float | None:
+        """
+        STOP every board in parallel; the slowest STOPPED latency in ms, or
+        None if any board did not answer.
+        """
+        latencies = run_parallel(lambda s: stop_song(s, timeout), self.sessions)
+        return None if None in latencies else max(latencies)
+
+    def status(self) -> list:
+        return [dict(s.status(), servos=list(s.servos)) for s in self.sessions]
+
+    def metrics(self, clear: bool = False) -> list:
+        found = run_parallel(lambda s: s.metrics(clear), self.sessions)
+        return [dict(m, servos=list(s.servos)) for s, m in zip(self.sessions, found)]
+
+    def close(self) -> None:
+        for s in self.sessions:
+            s.close()
 
 # --- Musical primitives -------------------------------------------------------
 
+# Schedule times are integer microseconds after sync; offsets written in
+# calibrated commands stay in ms and are scaled on the way through. Beats
+# become time through the song's TempoMap; without one, BPM applies.
+
+DEFAULT_TEMPO = tempomap.TempoMap.constant(BPM)
+
+def beats_to_us(beats: float, tempo: tempomap.TempoMap = None) -> int:
+    return (tempo or DEFAULT_TEMPO).beat_to_us(beats)
+
 class TimedAction:
     """
     Represents a single servo move at a scheduled time.
@@ -158,9 +1083,9 @@ class TimedAction:
         self.beat_offset = beat_offset                   # Offset in beats.
         self.ms_offset   = ms_offset                     # Additional ms offset.
 
-    def compute_delay(self, base_time: int) -> int:
-        # Calculate absolute execution time in ms.
-        return base_time + int(self.beat_offset * ms_per_beat) + self.ms_offset
+    def compute_delay(self, base_beat: float, tempo: tempomap.TempoMap) -> int:
+        # Calculate absolute execution time in us.
+        return tempo.beat_to_us(base_beat + self.beat_offset) + self.ms_offset * 1000
 
 _last_pick_side: dict[int,bool] = {}                   # Tracks pick orientation state.
 
@@ -177,9 +1102,9 @@ class PickAction:
         self.beat_offset = beat_offset                   # Offset in beats.
         self.ms_offset   = ms_offset                     # Additional ms offset.
 
-    def compute_delay(self, base_time: int) -> int:
-        # Calculate absolute execution time in ms.
-        return base_time + int(self.beat_offset * ms_per_beat) + self.ms_offset
+    def compute_delay(self, base_beat: float, tempo: tempomap.TempoMap) -> int:
+        # Calculate absolute execution time in us.
+        return tempo.beat_to_us(base_beat + self.beat_offset) + self.ms_offset * 1000
         
 class FretAction:
     """
@@ -196,9 +1121,9 @@ class FretAction:
         self.ms_offset     = ms_offset                 # Additional ms offset.
         self.release_after = release_after             # Delay before automatic release.
 
-    def compute_delay(self, base_time: int) -> int:
-        # Calculate absolute execution time in ms.
-        return base_time + int(self.beat_offset * ms_per_beat) + self.ms_offset
+    def compute_delay(self, base_beat: float, tempo: tempomap.TempoMap) -> int:
+        # Calculate absolute execution time in us.
+        return tempo.beat_to_us(base_beat + self.beat_offset) + self.ms_offset * 1000
 
 class SongCommand:
     """
@@ -208,50 +1133,54 @@ class SongCommand:
         self.name    = name                            # Identifier for the command.
         self.actions = actions                         # List of timed or pick/fret actions.
 
-    def schedule(self, ser: serial.Serial, base_time: int, duration_beats: float = None) -> None:
+    def records(self, base_beat: float, duration_beats: float = None,
+                tempo: tempomap.TempoMap = None) -> list:
         """
-        Schedule each action by sending appropriate packets.
+        Expand every action into (target, angle, delay) records for a
+        command at base_beat of a song with the given tempo map.
         If duration_beats is specified, use it to calculate release for FretActions.
         """
-        if DEBUG:
-            print(f"[cmd] Scheduling '{self.name}' @ {base_time} ms")  # Log command schedule.
-
+        tempo = tempo or DEFAULT_TEMPO
+        recs = []
         for act in self.actions:
             if isinstance(act, PickAction):
-                d = act.compute_delay(base_time)
+                d = act.compute_delay(base_beat, tempo)
                 was_up = _last_pick_side.get(act.servo, False)
                 angle = act.angle_down if was_up else act.angle_up
                 _last_pick_side[act.servo] = not was_up
-                send_pick(ser, act.servo, angle, d)
+                recs.append((act.servo, angle, d))
 
             elif isinstance(act, FretAction):
-                press_t = act.compute_delay(base_time)
+                press_t = act.compute_delay(base_beat, tempo)
                 # Use duration_beats if given, otherwise default to 1.0 beat
-                release_after = int(duration_beats * ms_per_beat) if duration_beats is not None else int(1.0 * ms_per_beat)
+                release_after = tempo.span_us(base_beat + act.beat_offset,
+                                              duration_beats if duration_beats is not None else 1.0)
                 release_t = press_t + release_after
-                send_pick(ser, act.servo, act.press_angle, press_t)
-                send_pick(ser, act.servo, act.release_angle, release_t)
+                recs.append((act.servo, act.press_angle, press_t))
+                recs.append((act.servo, act.release_angle, release_t))
 
             else:
-                d = act.compute_delay(base_time)
-                send_pick(ser, act.servo, act.angle, d)
+                d = act.compute_delay(base_beat, tempo)
+                recs.append((act.servo, act.angle, d))
+        return recs
 
 class StrumCommand:
     """
     Represents a strum across specified strings with automatic up/down alternation.
     """
     _last_strum_up = False  # Class-level state: toggles between up and down
+    STRUM_SWEEP_US = 10_000 # Gap between successive strings in one strum
 
     def __init__(self, strings):
         self.strings = strings  # Indices of strings to strum (e.g. [0,1,2,3,4,5])
 
-    def schedule(self, ser, base_time, duration_beats=None):
+    def records(self, base_beat, duration_beats=None, tempo=None):
         """
-        Schedule the strum: alternate direction automatically,
+        Expand the strum: alternate direction automatically,
         strumming each specified string in order with sweep effect.
         """
         # Allow fret to happen first
-        base_time = base_time + 50
+        base_time = (tempo or DEFAULT_TEMPO).beat_to_us(base_beat) + 50_000
         
         # Toggle direction for each strum
         StrumCommand._last_strum_up = not StrumCommand._last_strum_up
@@ -262,12 +1191,14 @@ class StrumCommand:
         if is_up:
             strum_order = list(reversed(strum_order))
 
+        recs = []
         for i, string_idx in enumerate(strum_order):
             string_name = INDEX_TO_STRING[string_idx]
             angles = get_pick_angles(string_name)
             angle = angles["up"] if is_up else angles["down"]
-            delay = base_time + i * 10  # 10 ms sweep between each string
-            send_pick(ser, string_idx, angle, delay)  # Send pick command
+            delay = base_time + i * StrumCommand.STRUM_SWEEP_US  # Sweep between each string
+            recs.append((string_idx, angle, delay))
+        return recs
 
 # --- Helper Functions ----------------------------------
        
@@ -327,324 +1258,488 @@ def resolve_command(ev):
     
 # --- Pre-defined SongCommands (calibrated) -----------------------------------
 
-RESET = SongCommand("RESET", [
-    # Picking servos to neutral (one per string)
-    TimedAction(0, get_pick_neutral('e'), beat_offset=0.0),
-    TimedAction(1, get_pick_neutral('A'), beat_offset=0.0),
-    TimedAction(2, get_pick_neutral('D'), beat_offset=0.0),
-    TimedAction(3, get_pick_neutral('G'), beat_offset=0.0),
-    TimedAction(4, get_pick_neutral('B'), beat_offset=0.0),
-    TimedAction(5, get_pick_neutral('E'), beat_offset=0.0),
-    # Fretting servos to their specific neutral angles (must specify both servo and string)
-    TimedAction(6,  get_fret_neutral('e', 6),  beat_offset=0.5),
-    TimedAction(7,  get_fret_neutral('A', 7),  beat_offset=0.5),
-    TimedAction(8,  get_fret_neutral('D', 8),  beat_offset=0.5),
-    TimedAction(9,  get_fret_neutral('G', 9),  beat_offset=0.5),
-    TimedAction(10, get_fret_neutral('B', 10), beat_offset=0.5),
-    TimedAction(11, get_fret_neutral('E', 11), beat_offset=0.5),
-    
-    TimedAction(12, get_fret_neutral('e', 12),  beat_offset=1.0),
-    TimedAction(13, get_fret_neutral('A', 13),  beat_offset=1.0),
-    TimedAction(14, get_fret_neutral('D', 14),  beat_offset=1.0),
-    TimedAction(15, get_fret_neutral('G', 15),  beat_offset=1.0),
-    TimedAction(16, get_fret_neutral('B', 16),  beat_offset=1.0),
-    TimedAction(17, get_fret_neutral('E', 17),  beat_offset=1.0),
-])
-
-# Low e string
-e0 = SongCommand("e0", [
-    make_pick_action('e', servo=0, beat_offset=0.0, ms_offset=50)
-])
-e1 = SongCommand("e1", [
-    make_fret_action('e', 1, servo=6, beat_offset=0.0, ms_offset=0),
-    make_pick_action('e', servo=0, beat_offset=0.0, ms_offset=50)
-])
-e2 = SongCommand("e2", [
-    make_fret_action('e', 2, servo=6, beat_offset=0.0, ms_offset=0),
-    make_pick_action('e', servo=0, beat_offset=0.0, ms_offset=50)
-])
-e3 = SongCommand("e3", [
-    make_fret_action('e', 3, servo=12, beat_offset=0.0, ms_offset=0),
-    make_pick_action('e', servo=0, beat_offset=0.0, ms_offset=50)
-])
-e4 = SongCommand("e4", [
-    make_fret_action('e', 4, servo=12, beat_offset=0.0, ms_offset=0),
-    make_pick_action('e', servo=0, beat_offset=0.0, ms_offset=50)
-])
-
-# A string
-A0 = SongCommand("A0", [
-    make_pick_action('A', servo=1, beat_offset=0.0, ms_offset=50)
-])
-A1 = SongCommand("A1", [
-    make_fret_action('A', 1, servo=7, beat_offset=0.0, ms_offset=0),
-    make_pick_action('A', servo=1, beat_offset=0.0, ms_offset=50)
-])
-A2 = SongCommand("A2", [
-    make_fret_action('A', 2, servo=7, beat_offset=0.0, ms_offset=0),
-    make_pick_action('A', servo=1, beat_offset=0.0, ms_offset=50)
-])
-A3 = SongCommand("A3", [
-    make_fret_action('A', 3, servo=13, beat_offset=0.0, ms_offset=0),
-    make_pick_action('A', servo=1, beat_offset=0.0, ms_offset=50)
-])
-A4 = SongCommand("A4", [
-    make_fret_action('A', 4, servo=13, beat_offset=0.0, ms_offset=0),
-    make_pick_action('A', servo=1, beat_offset=0.0, ms_offset=50)
-])
-
-# D string
-D0 = SongCommand("D0", [make_pick_action('D', servo=2, beat_offset=0.0, ms_offset=100)])
-D1 = SongCommand("D1", [
-    make_fret_action('D', 1, servo=8, beat_offset=0.0, ms_offset=0),
-    make_pick_action('D', servo=2, beat_offset=0.0, ms_offset=50)
-])
-D2 = SongCommand("D2", [
-    make_fret_action('D', 2, servo=8, beat_offset=0.0, ms_offset=0),
-    make_pick_action('D', servo=2, beat_offset=0.0, ms_offset=50)
-])
-D3 = SongCommand("D3", [
-    make_fret_action('D', 3, servo=14, beat_offset=0.0, ms_offset=0),
-    make_pick_action('D', servo=2, beat_offset=0.0, ms_offset=50)
-])
-D4 = SongCommand("D4", [
-    make_fret_action('D', 4, servo=14, beat_offset=0.0, ms_offset=0),
-    make_pick_action('D', servo=2, beat_offset=0.0, ms_offset=50)
-])
-
-# G string
-G0 = SongCommand("G0", [make_pick_action('G', servo=3, beat_offset=0.0, ms_offset=100)])
-G1 = SongCommand("G1", [
-    make_fret_action('G', 1, servo=9, beat_offset=0.0, ms_offset=0),
-    make_pick_action('G', servo=3, beat_offset=0.0, ms_offset=50)
-])
-G2 = SongCommand("G2", [
-    make_fret_action('G', 2, servo=9, beat_offset=0.0, ms_offset=0),
-    make_pick_action('G', servo=3, beat_offset=0.0, ms_offset=50)
-])
-G3 = SongCommand("G3", [
-    make_fret_action('G', 3, servo=15, beat_offset=0.0, ms_offset=0),
-    make_pick_action('G', servo=3, beat_offset=0.0, ms_offset=50)
-])
-G4 = SongCommand("G4", [
-    make_fret_action('G', 4, servo=15, beat_offset=0.0, ms_offset=0),
-    make_pick_action('G', servo=3, beat_offset=0.0, ms_offset=50)
-])
-
-# B string
-B0 = SongCommand("B0", [make_pick_action('B', servo=4, beat_offset=0.0, ms_offset=100)])
-B1 = SongCommand("B1", [
-    make_fret_action('B', 1, servo=10, beat_offset=0.0, ms_offset=0),
-    make_pick_action('B', servo=4, beat_offset=0.0, ms_offset=50)
-])
-B2 = SongCommand("B2", [
-    make_fret_action('B', 2, servo=10, beat_offset=0.0, ms_offset=0),
-    make_pick_action('B', servo=4, beat_offset=0.0, ms_offset=50)
-])
-B3 = SongCommand("B3", [
-    make_fret_action('B', 3, servo=16, beat_offset=0.0, ms_offset=0),
-    make_pick_action('B', servo=4, beat_offset=0.0, ms_offset=50)
-])
-B4 = SongCommand("B4", [
-    make_fret_action('B', 4, servo=16, beat_offset=0.0, ms_offset=0),
-    make_pick_action('B', servo=4, beat_offset=0.0, ms_offset=50)
-])
-
-# High E string
-E0 = SongCommand("E0", [make_pick_action('E', servo=5, beat_offset=0.0, ms_offset=50)])
-E1 = SongCommand("E1", [
-    make_fret_action('E', 1, servo=11, beat_offset=0.0, ms_offset=0),
-    make_pick_action('E', servo=5, beat_offset=0.0, ms_offset=50)
-])
-E2 = SongCommand("E2", [
-    make_fret_action('E', 2, servo=11, beat_offset=0.0, ms_offset=0),
-    make_pick_action('E', servo=5, beat_offset=0.0, ms_offset=50)
-])
-E3 = SongCommand("E3", [
-    make_fret_action('E', 3, servo=17, beat_offset=0.0, ms_offset=0),
-    make_pick_action('E', servo=5, beat_offset=0.0, ms_offset=50)
-])
-E4 = SongCommand("E4", [
-    make_fret_action('E', 4, servo=17, beat_offset=0.0, ms_offset=0),
-    make_pick_action('E', servo=5, beat_offset=0.0, ms_offset=50)
-])
-
-# Chords
-Chord_F  = make_chord("Chord_F", B1, G2, D3, A3)
-Chord_G  = make_chord("Chord_G", A2, e3, E3)
-Chord_C  = make_chord("Chord_C", B1, D2, A3)
-Chord_Am = make_chord("Chord_Am", B1, G2, D2)
-Chord_E7 = make_chord("Chord_E7", G1, A2)
+def build_command_map() -> dict:
+    """
+    Build every calibrated SongCommand from the current calibration data,
+    keyed by the name song files use.
+    """
+    RESET = SongCommand("RESET", [
+        # Picking servos to neutral (one per string)
+        TimedAction(0, get_pick_neutral('e'), beat_offset=0.0),
+        TimedAction(1, get_pick_neutral('A'), beat_offset=0.0),
+        TimedAction(2, get_pick_neutral('D'), beat_offset=0.0),
+        TimedAction(3, get_pick_neutral('G'), beat_offset=0.0),
+        TimedAction(4, get_pick_neutral('B'), beat_offset=0.0),
+        TimedAction(5, get_pick_neutral('E'), beat_offset=0.0),
+        # Fretting servos to their specific neutral angles (must specify both servo and string)
+        TimedAction(6,  get_fret_neutral('e', 6),  beat_offset=0.5),
+        TimedAction(7,  get_fret_neutral('A', 7),  beat_offset=0.5),
+        TimedAction(8,  get_fret_neutral('D', 8),  beat_offset=0.5),
+        TimedAction(9,  get_fret_neutral('G', 9),  beat_offset=0.5),
+        TimedAction(10, get_fret_neutral('B', 10), beat_offset=0.5),
+        TimedAction(11, get_fret_neutral('E', 11), beat_offset=0.5),
+
+        TimedAction(12, get_fret_neutral('e', 12),  beat_offset=1.0),
+        TimedAction(13, get_fret_neutral('A', 13),  beat_offset=1.0),
+        TimedAction(14, get_fret_neutral('D', 14),  beat_offset=1.0),
+        TimedAction(15, get_fret_neutral('G', 15),  beat_offset=1.0),
+        TimedAction(16, get_fret_neutral('B', 16),  beat_offset=1.0),
+        TimedAction(17, get_fret_neutral('E', 17),  beat_offset=1.0),
+    ])
+
+    # Low e string
+    e0 = SongCommand("e0", [
+        make_pick_action('e', servo=0, beat_offset=0.0, ms_offset=50)
+    ])
+    e1 = SongCommand("e1", [
+        make_fret_action('e', 1, servo=6, beat_offset=0.0, ms_offset=0),
+        make_pick_action('e', servo=0, beat_offset=0.0, ms_offset=50)
+    ])
+    e2 = SongCommand("e2", [
+        make_fret_action('e', 2, servo=6, beat_offset=0.0, ms_offset=0),
+        make_pick_action('e', servo=0, beat_offset=0.0, ms_offset=50)
+    ])
+    e3 = SongCommand("e3", [
+        make_fret_action('e', 3, servo=12, beat_offset=0.0, ms_offset=0),
+        make_pick_action('e', servo=0, beat_offset=0.0, ms_offset=50)
+    ])
+    e4 = SongCommand("e4", [
+        make_fret_action('e', 4, servo=12, beat_offset=0.0, ms_offset=0),
+        make_pick_action('e', servo=0, beat_offset=0.0, ms_offset=50)
+    ])
 
-# Map song commands by name for lookup during playback.
-command_map: dict[str, SongCommand] = {
-    # e string (high e, string 1)
-    "e0": e0, "e1": e1, "e2": e2, "e3": e3, "e4": e4,
     # A string
-    "A0": A0, "A1": A1, "A2": A2, "A3": A3, "A4": A4,
+    A0 = SongCommand("A0", [
+        make_pick_action('A', servo=1, beat_offset=0.0, ms_offset=50)
+    ])
+    A1 = SongCommand("A1", [
+        make_fret_action('A', 1, servo=7, beat_offset=0.0, ms_offset=0),
+        make_pick_action('A', servo=1, beat_offset=0.0, ms_offset=50)
+    ])
+    A2 = SongCommand("A2", [
+        make_fret_action('A', 2, servo=7, beat_offset=0.0, ms_offset=0),
+        make_pick_action('A', servo=1, beat_offset=0.0, ms_offset=50)
+    ])
+    A3 = SongCommand("A3", [
+        make_fret_action('A', 3, servo=13, beat_offset=0.0, ms_offset=0),
+        make_pick_action('A', servo=1, beat_offset=0.0, ms_offset=50)
+    ])
+    A4 = SongCommand("A4", [
+        make_fret_action('A', 4, servo=13, beat_offset=0.0, ms_offset=0),
+        make_pick_action('A', servo=1, beat_offset=0.0, ms_offset=50)
+    ])
+
     # D string
-    "D0": D0, "D1": D1, "D2": D2, "D3": D3, "D4": D4,
+    D0 = SongCommand("D0", [make_pick_action('D', servo=2, beat_offset=0.0, ms_offset=100)])
+    D1 = SongCommand("D1", [
+        make_fret_action('D', 1, servo=8, beat_offset=0.0, ms_offset=0),
+        make_pick_action('D', servo=2, beat_offset=0.0, ms_offset=50)
+    ])
+    D2 = SongCommand("D2", [
+        make_fret_action('D', 2, servo=8, beat_offset=0.0, ms_offset=0),
+        make_pick_action('D', servo=2, beat_offset=0.0, ms_offset=50)
+    ])
+    D3 = SongCommand("D3", [
+        make_fret_action('D', 3, servo=14, beat_offset=0.0, ms_offset=0),
+        make_pick_action('D', servo=2, beat_offset=0.0, ms_offset=50)
+    ])
+    D4 = SongCommand("D4", [
+        make_fret_action('D', 4, servo=14, beat_offset=0.0, ms_offset=0),
+        make_pick_action('D', servo=2, beat_offset=0.0, ms_offset=50)
+    ])
+
     # G string
-    "G0": G0, "G1": G1, "G2": G2, "G3": G3, "G4": G4,
+    G0 = SongCommand("G0", [make_pick_action('G', servo=3, beat_offset=0.0, ms_offset=100)])
+    G1 = SongCommand("G1", [
+        make_fret_action('G', 1, servo=9, beat_offset=0.0, ms_offset=0),
+        make_pick_action('G', servo=3, beat_offset=0.0, ms_offset=50)
+    ])
+    G2 = SongCommand("G2", [
+        make_fret_action('G', 2, servo=9, beat_offset=0.0, ms_offset=0),
+        make_pick_action('G', servo=3, beat_offset=0.0, ms_offset=50)
+    ])
+    G3 = SongCommand("G3", [
+        make_fret_action('G', 3, servo=15, beat_offset=0.0, ms_offset=0),
+        make_pick_action('G', servo=3, beat_offset=0.0, ms_offset=50)
+    ])
+    G4 = SongCommand("G4", [
+        make_fret_action('G', 4, servo=15, beat_offset=0.0, ms_offset=0),
+        make_pick_action('G', servo=3, beat_offset=0.0, ms_offset=50)
+    ])
+
     # B string
-    "B0": B0, "B1": B1, "B2": B2, "B3": B3, "B4": B4, 
-    # E string (low E, string 6)
-    "E0": E0, "E1": E1, "E2": E2, "E3": E3, "E4": E4,
-    # Reset
-    "RESET": RESET,
-    # Strum
-    "STRUM": lambda ev: StrumCommand(ev.get("strings", [0,1,2,3,4,5])),
+    B0 = SongCommand("B0", [make_pick_action('B', servo=4, beat_offset=0.0, ms_offset=100)])
+    B1 = SongCommand("B1", [
+        make_fret_action('B', 1, servo=10, beat_offset=0.0, ms_offset=0),
+        make_pick_action('B', servo=4, beat_offset=0.0, ms_offset=50)
+    ])
+    B2 = SongCommand("B2", [
+        make_fret_action('B', 2, servo=10, beat_offset=0.0, ms_offset=0),
+        make_pick_action('B', servo=4, beat_offset=0.0, ms_offset=50)
+    ])
+    B3 = SongCommand("B3", [
+        make_fret_action('B', 3, servo=16, beat_offset=0.0, ms_offset=0),
+        make_pick_action('B', servo=4, beat_offset=0.0, ms_offset=50)
+    ])
+    B4 = SongCommand("B4", [
+        make_fret_action('B', 4, servo=16, beat_offset=0.0, ms_offset=0),
+        make_pick_action('B', servo=4, beat_offset=0.0, ms_offset=50)
+    ])
+
+    # High E string
+    E0 = SongCommand("E0", [make_pick_action('E', servo=5, beat_offset=0.0, ms_offset=50)])
+    E1 = SongCommand("E1", [
+        make_fret_action('E', 1, servo=11, beat_offset=0.0, ms_offset=0),
+        make_pick_action('E', servo=5, beat_offset=0.0, ms_offset=50)
+    ])
+    E2 = SongCommand("E2", [
+        make_fret_action('E', 2, servo=11, beat_offset=0.0, ms_offset=0),
+        make_pick_action('E', servo=5, beat_offset=0.0, ms_offset=50)
+    ])
+    E3 = SongCommand("E3", [
+        make_fret_action('E', 3, servo=17, beat_offset=0.0, ms_offset=0),
+        make_pick_action('E', servo=5, beat_offset=0.0, ms_offset=50)
+    ])
+    E4 = SongCommand("E4", [
+        make_fret_action('E', 4, servo=17, beat_offset=0.0, ms_offset=0),
+        make_pick_action('E', servo=5, beat_offset=0.0, ms_offset=50)
+    ])
+
     # Chords
-    "Chord_F": Chord_F, "Chord_G": Chord_G, "Chord_C": Chord_C, "Chord_Am": Chord_Am, "Chord_E7": Chord_E7, 
-}
+    Chord_F  = make_chord("Chord_F", B1, G2, D3, A3)
+    Chord_G  = make_chord("Chord_G", A2, e3, E3)
+    Chord_C  = make_chord("Chord_C", B1, D2, A3)
+    Chord_Am = make_chord("Chord_Am", B1, G2, D2)
+    Chord_E7 = make_chord("Chord_E7", G1, A2)
+
+    # Name used in song files -> command.
+    return {
+        # e string (high e, string 1)
+        "e0": e0, "e1": e1, "e2": e2, "e3": e3, "e4": e4,
+        # A string
+        "A0": A0, "A1": A1, "A2": A2, "A3": A3, "A4": A4,
+        # D string
+        "D0": D0, "D1": D1, "D2": D2, "D3": D3, "D4": D4,
+        # G string
+        "G0": G0, "G1": G1, "G2": G2, "G3": G3, "G4": G4,
+        # B string
+        "B0": B0, "B1": B1, "B2": B2, "B3": B3, "B4": B4, 
+        # E string (low E, string 6)
+        "E0": E0, "E1": E1, "E2": E2, "E3": E3, "E4": E4,
+        # Reset
+        "RESET": RESET,
+        # Strum
+        "STRUM": lambda ev: StrumCommand(ev.get("strings", [0,1,2,3,4,5])),
+        # Chords
+        "Chord_F": Chord_F, "Chord_G": Chord_G, "Chord_C": Chord_C, "Chord_Am": Chord_Am, "Chord_E7": Chord_E7, 
+    }
+
+# Map song commands by name for lookup during playback.
+command_map: dict[str, SongCommand] = build_command_map()
+
+# --- Pose registers -----------------------------------------------------------
+
+def build_poses() -> list:
+    """
+    Derive the pose table uploaded to the Arduino, as {servo: angle} dicts.
+
+    Pose 0 is every servo at neutral. The rest come from the calibrated
+    commands: any group of two or more servos that always move together
+    (RESET steps, a chord's fret presses, its releases) becomes a pose, in
+    command-name order, until the registers run out. The table depends only
+    on calibration, so a compiled song and the upload always agree.
+    """
+    poses = [dict(enumerate(neutral_angles(calibration)))]
+    for name in sorted(k for k, v in command_map.items() if isinstance(v, SongCommand)):
+        groups = {}
+        for act in command_map[name].actions:
+            key = (act.beat_offset, act.ms_offset)
+            if isinstance(act, FretAction):
+                groups.setdefault(key + ("press",), {})[act.servo]   = act.press_angle
+                groups.setdefault(key + ("release",), {})[act.servo] = act.release_angle
+            elif isinstance(act, TimedAction):
+                groups.setdefault(key, {})[act.servo] = act.angle
+        for pose in groups.values():
+            if len(pose) >= 2 and pose not in poses and len(poses) < MAX_POSES:
+                poses.append(pose)
+    return poses
+
+def pose_packets(poses: list) -> list:
+    """
+    POSE_DEFINE packets: [0xC2][id][angle x NUM_SERVOS], 0xFF = unchanged.
+    """
+    return [(POSE_DEFINE_MARKER,
+             bytes([pid]) + bytes(pose.get(servo, POSE_UNCHANGED) for servo in range(NUM_SERVOS)))
+            for pid, pose in enumerate(poses)]
+
+def reload_calibration(path: str = CALIBRATION_PATH) -> None:
+    """
+    Re-read calibration.json and rebuild command_map in place.
+    """
+    with open(path, "r") as f:
+        fresh = json.load(f)
+    calibration.clear()
+    calibration.update(fresh)
+    command_map.clear()
+    command_map.update(build_command_map())
 
 # --- High-level play_song function -------------------------------------------
-def play_song(song_name: str, songs_dir: str = "./songs", set_start_time_cb=None, on_finish_cb=None) -> None:
+
+class DevicePlayback:
+    """
+    One session's part of a song, started against a Pi start time shared
+    with every other device playing it.
+
+    prepare() does the slow, per-port work (connect, registers, upload,
+    clock burst) and may run in a thread per device; start() only sends
+    the SYNC or PLAY_STORED and starts the writer and clock tracker.
     """
-    Load song JSON, synchronise with Arduino, flatten events,
-    schedule actions, and honour cancellation requests.
+    def __init__(self, session: "SerialSession", song, untethered: bool, from_us: int):
+        self.session    = session
+        self.records    = session.part(song)         # (abs_us, servo, angle) on this board.
+        self.times      = [r[0] for r in self.records]
+        self.end_us     = song.analysis.end_us       # END_MARKER time relative to sync.
+        self.song_id    = session.part_id(song)      # Stored-song id for this part.
+        self.untethered = untethered
+        self.from_us    = from_us
+        self.local      = False                      # Played from the board's song store.
+        self.pi_start_us = None                      # Pi time of song time 0, once started.
+        self.link       = None
+        self.writer     = None
+        self.tracker    = None
+        self.finished   = threading.Event()          # Ends the clock tracker.
+        self.acquired   = False
+
+    def prepare(self) -> None:
+        session = self.session
+        if not session.playing.acquire(blocking=False):
+            raise RuntimeError(f"A song is already playing on {session.port}")
+        self.acquired = True
+        session.stop_event.clear()                    # Reset any prior stop signal.
+        if DEBUG:
+            print(f"[debug] {session.port}: {len(self.records)} records, "
+                  f"end-of-song at {self.end_us} us")
+
+        session.open()                                # Connects and handshakes only the first time.
+        session.check_health()                        # Drop a negotiated rate that is failing.
+        self.link = session.open()                    # Same link unless the check reconnected.
+        session.upload_registers()                    # Pulse ranges and poses, if changed.
+
+        self.local = self.untethered and session.store_song(self.song_id, self.records, self.end_us)
+        if self.from_us and not self.local:
+            raise RuntimeError("Only a stored song can start part way in")
+
+        # Measure the clock just before the start, as play_song takes it.
+        if not session.clock.add_burst(self.link.probe_burst()):
+            raise TimeoutError(f"Arduino on {session.port} did not answer clock probes")
+
+    def start(self, sync_at_us: float) -> None:
+        """
+        Start the part so song time from_us falls on Pi time sync_at_us.
+        """
+        session, link, clock = self.session, self.link, self.session.clock
+        stop = session.stop_event
+        global_start_us = int(round(clock.to_arduino(sync_at_us))) & 0xFFFFFFFF
+        pi_start_us     = sync_at_us - self.from_us     # Pi time of song time 0.
+        self.pi_start_us = pi_start_us
+        if self.local:
+            if not link.play_stored(global_start_us, self.from_us):
+                raise RuntimeError(f"Arduino on {session.port} did not start its stored song")
+        else:
+            link.sync(global_start_us)
+
+        slack = session.send_slack
+        slack.start_song()
+
+        def send_chunk(chunk):
+            if not link.send_records(chunk, stop):
+                return False
+            slack.add(chunk[0][2] - (clocksync.pi_now_us() - pi_start_us))
+            return True
+
+        def stream_records():
+            # Writer thread: push records as soon as the Arduino has room.
+            chunk = []
+            for abs_us, servo, angle in self.records:
+                chunk.append((servo, angle, abs_us))
+                if len(chunk) == MAX_BATCH_RECORDS:
+                    if not send_chunk(chunk):
+                        return
+                    chunk = []
+            if chunk and not send_chunk(chunk):
+                return
+            if link.send_end(self.end_us, stop) and DEBUG:
+                print(f"[end] Sent END_MARKER @ {self.end_us} us - awaiting DONE")
+
+        def track_clock():
+            # Re-measure the clock during playback and re-anchor the
+            # Arduino's song clock on the improved offset and drift estimate.
+            while not self.finished.wait(RESYNC_INTERVAL):
+                session.check_health()
+                if not clock.add_burst(link.probe_burst()):
+                    continue
+                a = int(clock.points[-1][1])             # Arduino time of the newest point.
+                ref_song = int(round(clock.to_pi(a) - pi_start_us))
+                link.adjust_clock(a, ref_song, clock.rate_ppm())
+
+        if not self.local:
+            self.writer = threading.Thread(target=stream_records, daemon=True)
+            self.writer.start()
+        # A stored song is re-anchored too, so it stays on the Pi's clock.
+        self.tracker = threading.Thread(target=track_clock, daemon=True)
+        self.tracker.start()
+
+    def done(self) -> bool:
+        return self.link is not None and self.link.done.is_set()
+
+    def progress(self) -> tuple:
+        """
+        (records run, song us played to, True if the board reported it).
+
+        A streamed part counts what the board's FREE reports (or EXECUTED
+        telemetry) show has run. Between reports the Pi clock moves the time
+        on, but never past the record the board could at most have reached
+        without reporting. A stored song sends no reports: it is timed by
+        the Pi clock alone.
+        """
+        times = self.times
+        clock = clocksync.pi_now_us() - self.pi_start_us if self.pi_start_us is not None else 0
+        if self.done():
+            return len(times), self.end_us, not self.local
+        if self.local:
+            clock = max(self.from_us, min(clock, self.end_us))
+            return bisect.bisect_right(times, clock), clock, False
+        n = min(self.link.executed, len(times))
+        acked = times[n - 1] if n else 0
+        bound = times[n + CREDIT_REPORT_STEP - 1] if n + CREDIT_REPORT_STEP <= len(times) else self.end_us
+        return n, max(acked, min(clock, bound)), True
+
+    def stopped(self) -> bool:
+        return self.session.stop_event.is_set()
+
+    def finish(self) -> None:
+        self.finished.set()
+        if self.writer is not None:
+            self.writer.join(timeout=1.0)
+        if self.tracker is not None:
+            self.tracker.join(timeout=1.0)
+        if self.acquired:
+            self.session.playing.release()           # The port itself stays open.
+            self.acquired = False
+
+def run_parallel(fn, items: list) -> list:
     """
-    stop_event.clear()                                # Reset any prior stop signal.
-    ser = connect()                                   # Establish serial connection.
+    fn(item) for every item, each in its own thread; results in order.
+    The first exception raised is re-raised once all have finished.
+    """
+    if len(items) == 1:
+        return [fn(items[0])]
+    results = [None] * len(items)
+    errors  = []
+    def run(i, item):
+        try:
+            results[i] = fn(item)
+        except Exception as e:
+            errors.append(e)
+    threads = [threading.Thread(target=run, args=(i, item), daemon=True)
+               for i, item in enumerate(items)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    if errors:
+        raise errors[0]
+    return results
+
+def play_song(song_name: str, songs_dir: str = "./songs", set_start_time_cb=None, on_finish_cb=None,
+              session: SerialSession | None = None, untethered: bool = False,
+              from_us: int = 0, sessions: list | None = None, on_progress_cb=None) -> None:
+    """
+    Load the compiled song, synchronise with Arduino, stream records
+    as queue credit allows, and honour cancellation requests.
+
+    Runs over the shared session (the default one unless given), which
+    stays open afterwards. Delays sent to the Arduino are in microseconds
+    relative to the SYNC start time, which already includes SYNC_DELAY_MS.
+
+    With sessions, the song is split across several boards by each
+    session's servo range and every part starts at the same Pi time: each
+    board's drift-corrected clock maps that one instant to its own
+    micros(). Ports are prepared and streamed in parallel, one thread
+    each, so a board added costs no scheduling time on the others.
+
+    With untethered, the song is played from the board's song store
+    (uploaded first unless it is already there) and nothing is streamed;
+    from_us then starts it part way in. A song the store cannot hold is
+    streamed as usual, from the start only.
+
+    on_progress_cb(progress) gets a dict of executed and total records,
+    song_us, beat and section (see DevicePlayback.progress) whenever the
+    boards report commands run, and every PROGRESS_INTERVAL otherwise.
+    """
+    import songcompiler                               # Deferred: songcompiler builds on this module.
+
+    sessions = sessions or [session or get_session()]
+    parts = []
+    song  = None
     try:
-        # Synchronise clocks before streaming commands.
-        arduino_ms      = get_arduino_time(ser)
-        global_start_ms = arduino_ms + SYNC_DELAY_MS
-        send_sync(ser, global_start_ms)
-        
+        song  = songcompiler.load_song(song_name, songs_dir)  # Compile on first use, then mmap.
+        parts = [DevicePlayback(s, song, untethered, from_us) for s in sessions]
+        run_parallel(DevicePlayback.prepare, parts)
+
+        sync_at_us = clocksync.pi_now_us() + SYNC_DELAY_MS * 1000  # Pi time the song starts.
+        for part in parts:
+            part.start(sync_at_us)
+
         # Set _start_time callback here, as this is when sync delay officially begins
         if set_start_time_cb is not None:
-            # Pi wall time when SYNC packet is sent, minus SYNC_DELAY_MS, matches the timeline logic
-            set_start_time_cb(time.time() * 1000.0 + 1000)
-
-        time.sleep(0.1)                               # Brief pause post-sync.
-
-        # Load song structure from JSON file.
-        path = f"{songs_dir}/{song_name}.json"
-        with open(path, "r") as f:
-            score = json.load(f)
-            
-        sections_map = score.get("sections", {})     # Named section definitions.
-        timeline     = score["timeline"]              # Sequence of section/note events.
-
-        # Flatten timeline by expanding section references.
-        flat_events = []
-        for ev in timeline:
-            beat = ev["beat"]; cmd = ev["cmd"]
-            if cmd in sections_map:
-                for sub in sections_map[cmd]:
-                    ev_copy = dict(sub)  # Copy all fields of the sub-event (including "duration"!)
-                    ev_copy["beat"] = beat + sub["beat"]  # Adjust the beat
-                    flat_events.append(ev_copy)
-            else:
-                flat_events.append(ev)
+            # Pi wall time SYNC_DELAY_MS before song time 0, so progress
+            # runs against the song's analysed length with no fudge.
+            ahead_us = sync_at_us - clocksync.pi_now_us()
+            set_start_time_cb(time.time() * 1000.0 + ahead_us / 1000.0 - SYNC_DELAY_MS)
 
-        flat_events.sort(key=lambda e: e["beat"])      # Order events chronologically.
-        if DEBUG:
-            for ev in flat_events:
-                print(f"[debug] beat={ev['beat']}, cmd='{ev['cmd']}', duration={ev.get('duration')}")
-                
-        # Determine end-of-song time including last release and slack.
-        max_rel = 0
-        for ev in flat_events:
-            if stop_event.is_set():
-                return  # Exit as soon as stop_event is set
-            beat   = ev["beat"]
-            
-            action = resolve_command(ev)
-            if action is None:
-                raise KeyError(f"Unknown command: '{ev['cmd']}'")
-            if callable(action):
-                raise RuntimeError(f"Command {ev['cmd']} did not resolve to an instance but to a function: {action}")
-
-            # Only SongCommand instances have 'actions'
-            if hasattr(action, "actions"):
-                for act in action.actions:
-                    inner = getattr(act, "beat_offset", 0.0)
-                    rel = int((beat + inner) * ms_per_beat) + getattr(act, "ms_offset", 0)
-                    if isinstance(act, FretAction):
-                        # Use per-note duration if present in event, else default to 1 beat
-                        duration_beats = ev.get("duration", 1.0)
-                        rel += int(duration_beats * ms_per_beat)
-                    if rel > max_rel:
-                        max_rel = rel
-            elif isinstance(action, StrumCommand):
-                # For StrumCommand, estimate delay of last string
-                num_strings = len(action.strings)
-                # Strum direction: first or last, both take similar max time
-                strum_end = int(beat * ms_per_beat) + (num_strings - 1) * 10
-                rel = strum_end
-                if rel > max_rel:
-                    max_rel = rel
-            else:
-                print(f"[error] Unexpected action type: {type(action)}, event: {ev}, command: {ev.get('cmd')}")
-                raise TypeError(f"Command '{ev.get('cmd')}' did not resolve to SongCommand or StrumCommand but to {type(action)}")
-
-        end_rel = global_start_ms + max_rel + END_SLACK  # Absolute time for END_MARKER.
-        if DEBUG:
-            print(f"[debug] end-of-song at {end_rel} ms")
+        last_progress = (None, 0.0)
 
-        # Precompute absolute execution times for each event
-        for ev in flat_events:
-            beat = ev["beat"]
-            ev["_abs_time"] = global_start_ms + int(beat * ms_per_beat)
-        
-        event_idx = 0
-        num_events = len(flat_events)
-        sent_end_marker = False
-
-        # Stream each event to the Arduino in sequence.
-        while event_idx < num_events and not stop_event.is_set():
-            # Query current Arduino time (relative to sync point!)
-            arduino_time = get_arduino_time(ser)
-            now = arduino_time  # already ms since sync
-    
-            # Send any actions due within the window
-            while (event_idx < num_events and flat_events[event_idx]["_abs_time"] - global_start_ms <= now + WINDOW_MS):
-                ev = flat_events[event_idx]
-                base_ms = ev["_abs_time"]
-                duration_beats = ev.get("duration", None)
-                action = resolve_command(ev)
-                if action is None:
-                    raise KeyError(f"Unknown command: '{ev['cmd']}'")
-                if callable(action):
-                    raise RuntimeError(f"Command {ev['cmd']} did not resolve to an instance but to a function: {action}")
-                action.schedule(ser, base_ms, duration_beats=duration_beats)
-                event_idx += 1
-                
-            # If all events have been sent and END_MARKER not sent, send it now
-            if event_idx >= num_events and not sent_end_marker:
-                end_rel = global_start_ms + max_rel + END_SLACK
-                pkt = struct.pack('<BI', END_MARKER, end_rel)
-                ser.write(pkt)
-                sent_end_marker = True
-                if DEBUG:
-                    print(f"[end] Sent END_MARKER @ {end_rel} ms - awaiting DONE")
-            # Wait a bit before checking Arduino time again
-            time.sleep(CHECK_INTERVAL)
-            
-        while True:
-            if stop_event.is_set():
-                if DEBUG:
-                    print("[end] Stop event set during DONE wait, breaking loop")
-                break
+        def report_progress(force: bool = False):
+            runs  = [part.progress() for part in parts]
+            count = sum(r[0] for r in runs)
+            now   = time.monotonic()
+            if not force and count == last_progress[0] and now - last_progress[1] < PROGRESS_INTERVAL:
+                return last_progress
+            song_us = max(r[1] for r in runs)
+            on_progress_cb({
+                'executed': count,
+                'total':    sum(len(part.records) for part in parts),
+                'song_us':  song_us,
+                'end_us':   song.analysis.end_us,
+                'beat':     song.tempo.us_to_beat(max(song_us, 0)),
+                'section':  song.analysis.section_at(song_us),
+                'source':   'board' if any(r[2] for r in runs) else 'clock',
+            })
+            return (count, now)
 
-            try:
-                line = ser.readline().decode('utf-8', 'replace').strip()
-            except Exception as e:
+        # Wait for every Arduino to report DONE, for a stop request, or for
+        # a link to drop (its DONE would never arrive).
+        while not all(part.done() for part in parts):
+            if on_progress_cb is not None:
+                last_progress = report_progress()
+            if any(part.stopped() for part in parts):
                 if DEBUG:
-                    print(f"[end] Exception during readline: {e}")
+                    print("[end] Stop event set during playback, breaking loop")
                 break
-
-            if not line:
-                continue
+            lost = [part.session.port for part in parts if not part.done() and not part.link.alive()]
+            if lost:
+                raise ConnectionError(f"Link to {', '.join(lost)} lost during playback")
+            next(p for p in parts if not p.done()).link.done.wait(READ_TIMEOUT)
+        else:
+            if on_progress_cb is not None:
+                report_progress(force=True)
             if DEBUG:
-                print("From Arduino:", line)
-            if line == "DONE":
-                if DEBUG:
-                    print("[end] Received DONE - playback complete")
-                break
+                print("[end] Received DONE - playback complete")
     finally:
-        ser.close()                                    # Ensure serial port is closed.
+        for part in parts:
+            part.finish()
+        if song is not None:
+            song.close()                               # Parts hold their own record lists.
         if on_finish_cb is not None:
             on_finish_cb()                             # Reset state after playback ends/stops
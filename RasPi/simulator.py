@@ -0,0 +1,546 @@
+#!/usr/bin/env python3
+"""
+simulator.py
+
+
+Host-side stand-in for the Arduino sketch, so the scheduler can be run and
+measured without the robot (see benchmark.py).
+
+SimulatedArduino behaves like RemoteControl on the other end of the USB
+link: framing with CRC and NACK, the 128-slot command queue with FREE
+credit reports, clock probes, SYNC / CLOCK_ADJ, BATCH / END, pose and
+calibration uploads, the song store, STOP bursts and baud negotiation.
+Commands run when their song time comes, against micros() taken from the
+host's monotonic clock. Bytes take their time on the wire in both
+directions at the current rate (10 bits per byte), so a slow link shows
+up as it would on the Mega.
+
+It has the parts of the serial.Serial interface the scheduler uses, so a
+SerialSession can use it directly in place of a port; serve_pty() also
+puts it behind a pseudo-terminal for running with a real pyserial.
+
+Everything the run did is counted in SimulatedArduino.stats.
+"""
+
+import os                                            # Pseudo-terminal.
+import struct                                        # Packet payloads.
+import threading                                     # Simulation loop and pty pumps.
+import time                                          # Host clock behind micros().
+
+import scheduler                                     # Packet types, shared with the Pi side.
+import telemetry                                     # STATS reply layout.
+
+# --- Configuration ------------------------------------------------------------
+
+QUEUE_CAPACITY     = 128                             # RemoteControl::MAX_COMMANDS.
+CREDIT_REPORT_STEP = 8                               # Freed slots that trigger a FREE report.
+FRAME_BUFFER_SIZE  = 64                              # Largest decoded frame.
+FRAME_OVERHEAD     = 3                               # seq + type + crc.
+NACK_REPEAT_S      = 0.05                            # Earliest repeat of an unanswered NACK.
+SUPPORTED_BAUDS    = (115200, 250000, 500000, 1000000)  # As the sketch reports in CAPS.
+BAUD_TRIAL_S       = 1.0                             # A new rate needs a good frame by then.
+STORE_CAPACITY     = 816                             # Records in the EEPROM song store.
+BITS_PER_BYTE      = 10                              # Start + 8 data + stop.
+TICK_S             = 0.0005                          # Simulated loop() period.
+LATE_US            = 2000                            # Execution later than this counts as late.
+END_TARGET         = 255                             # End-of-song sentinel target.
+MICROS_START       = 0xFFF00000                      # micros() at start-up: wraps within ~1 s.
+
+class SimStats:
+    """
+    Totals for one simulated run. Times are microseconds.
+    """
+    def __init__(self):
+        self.bytes_in    = 0                         # Bytes received from the Pi.
+        self.bytes_out   = 0                         # Bytes sent to the Pi.
+        self.packets     = {}                        # Packet type -> count.
+        self.bad_frames  = 0                         # Frames failing CRC, length or sequence.
+        self.nacks       = 0                         # NACK lines sent.
+        self.rejected    = 0                         # Commands refused for a full queue.
+        self.accepted    = 0                         # Commands buffered (END included).
+        self.executed    = 0                         # Servo and pose commands run.
+        self.slack       = []                        # Per streamed command: deadline - arrival.
+        self.missed      = 0                         # Commands that arrived after their deadline.
+        self.late        = 0                         # Commands run more than LATE_US late.
+        self.max_late    = 0                         # Worst lateness.
+        self.lateness    = [0] * telemetry.LATENESS_BUCKETS  # As the sketch's histogram.
+        self.late_peak   = 0                         # max_late since the last STATS clear.
+        self.loop_min    = None                      # Shortest and longest loop pass (us).
+        self.loop_max    = 0
+        self.queue_max   = 0                         # Most commands buffered at once.
+        self._depth_area = 0.0                       # Integral of depth over playing time.
+        self._depth_time = 0.0
+        self.song_us     = 0                         # Song time from SYNC to DONE.
+
+    @property
+    def queue_mean(self) -> float:
+        return self._depth_area / self._depth_time if self._depth_time else 0.0
+
+    def to_dict(self) -> dict:
+        slack = sorted(self.slack)
+        def pct(p):
+            return slack[min(len(slack) - 1, int(p * len(slack)))] if slack else None
+        return {
+            'bytes_in':   self.bytes_in,
+            'bytes_out':  self.bytes_out,
+            'packets':    sum(self.packets.values()),
+            'by_type':    {f"0x{k:02X}": v for k, v in sorted(self.packets.items())},
+            'bad_frames': self.bad_frames,
+            'nacks':      self.nacks,
+            'rejected':   self.rejected,
+            'accepted':   self.accepted,
+            'executed':   self.executed,
+            'missed':     self.missed,
+            'late':       self.late,
+            'max_late_us': self.max_late,
+            'queue_max':  self.queue_max,
+            'queue_mean': round(self.queue_mean, 1),
+            'slack_min_us':    pct(0.0),
+            'slack_p5_us':     pct(0.05),
+            'slack_median_us': pct(0.5),
+            'song_us':    self.song_us,
+        }
+
+class SimulatedArduino:
+    """
+    The sketch's side of the link; see the module docstring.
+    """
+    def __init__(self, follow_baud: bool = False):
+        self.baudrate    = scheduler.BAUD_RATE       # Pi end, set by the scheduler like pyserial.
+        self.timeout     = 1.0
+        self.port        = 'sim'
+        self.dtr         = False
+        self.is_open     = True
+        self.stats       = SimStats()
+        self.follow_baud = follow_baud               # pty: the Pi's rate cannot be seen.
+        self._baud       = scheduler.BAUD_RATE       # Sketch end.
+        self._lock       = threading.Condition()
+        self._t0         = time.monotonic()
+        self._rx         = []                        # (arrival time, bytes) from the Pi.
+        self._rx_free    = 0.0                       # Time the Pi->board wire is free.
+        self._tx         = bytearray()               # Bytes for the Pi, oldest first.
+        self._tx_ready   = []                        # (time available, end offset in _tx).
+        self._tx_free    = 0.0
+        # Receiver
+        self._state      = 'hunt'
+        self._frame      = bytearray()
+        self._esc        = False
+        self._rx_seq     = None
+        self._nack_at    = None                      # Time of an unanswered NACK.
+        self._stop_run   = 0
+        self._trial      = None                      # (previous rate, started) while on trial.
+        # Scheduler
+        self._queue      = []                        # [delay, seq, target, angle, arrival song us]
+        self._seq        = 0
+        self._accepted   = 0
+        self._freed      = 0
+        self._synced     = False
+        self._ref_local  = 0
+        self._ref_song   = 0
+        self._rate_ppm   = 0
+        self._store      = None                      # (id, records, end us) once uploaded.
+        self._upload     = None
+        self._store_feed = None                      # [next record, song us] while playing it.
+        self.poses       = {}
+        self.servos      = {}                        # Last angle per servo, for inspection.
+        self._last_tick  = None
+        self._closing    = threading.Event()
+        self._thread     = threading.Thread(target=self._loop, daemon=True)
+        self._thread.start()
+
+    # --- serial.Serial interface ------------------------------------------------
+
+    def write(self, data: bytes) -> int:
+        with self._lock:
+            now = time.monotonic()
+            if self.baudrate != self._baud and not self.follow_baud:
+                data = bytes(0x55 for _ in data)    # Wrong rate: the UART sees garbage.
+            self._rx_free = max(now, self._rx_free) + len(data) * BITS_PER_BYTE / self.baudrate
+            self._rx.append((self._rx_free, bytes(data)))
+        return len(data)
+
+    @property
+    def in_waiting(self) -> int:
+        with self._lock:
+            return self._ready_bytes(time.monotonic())
+
+    def read(self, n: int = 1) -> bytes:
+        deadline = time.monotonic() + (self.timeout or 0)
+        with self._lock:
+            while True:
+                now   = time.monotonic()
+                ready = self._ready_bytes(now)
+                if ready or now >= deadline or self._closing.is_set():
+                    break
+                self._lock.wait(min(TICK_S, deadline - now))
+            n   = min(n, ready)
+            out = bytes(self._tx[:n])
+            del self._tx[:n]
+            self._tx_ready = [(t, end - n) for t, end in self._tx_ready if end - n > 0]
+            return out
+
+    def flush(self) -> None:
+        # Returns once everything written has reached the board.
+        while True:
+            with self._lock:
+                wait = self._rx_free - time.monotonic()
+            if wait <= 0:
+                return
+            time.sleep(wait)
+
+    def open(self) -> None:
+        pass
+
+    def reset_input_buffer(self) -> None:
+        with self._lock:
+            self._tx.clear()
+            self._tx_ready = []
+
+    def reset_output_buffer(self) -> None:
+        pass
+
+    def close(self) -> None:
+        self._closing.set()
+        self.is_open = False
+
+    def _ready_bytes(self, now: float) -> int:
+        ready = 0
+        for t, end in self._tx_ready:
+            if t > now:
+                break
+            ready = end
+        return ready
+
+    # --- Board side -------------------------------------------------------------
+
+    def micros(self, now: float | None = None) -> int:
+        now = time.monotonic() if now is None else now
+        return (int((now - self._t0) * 1e6) + MICROS_START) & 0xFFFFFFFF
+
+    def _song_time(self, now: float) -> int:
+        dt = ((self.micros(now) - self._ref_local + (1 << 31)) & 0xFFFFFFFF) - (1 << 31)
+        return self._ref_song + dt + dt * self._rate_ppm // 1000000
+
+    def _out(self, data: bytes) -> None:
+        # Caller holds the lock.
+        now = time.monotonic()
+        self._tx_free = max(now, self._tx_free) + len(data) * BITS_PER_BYTE / self._baud
+        if self._baud != self.baudrate and not self.follow_baud:
+            data = bytes(0x55 for _ in data)
+        self._tx += data
+        self._tx_ready.append((self._tx_free, len(self._tx)))
+        self.stats.bytes_out += len(data)
+        self._lock.notify_all()
+
+    def _line(self, text: str) -> None:
+        self._out(text.encode() + b'\n')
+
+    def _loop(self) -> None:
+        while not self._closing.is_set():
+            with self._lock:
+                now = time.monotonic()
+                while self._rx and self._rx[0][0] <= now:
+                    _, data = self._rx.pop(0)
+                    self.stats.bytes_in += len(data)
+                    for b in data:
+                        self._byte(b, now)
+                if self._trial and now - self._trial[1] > BAUD_TRIAL_S:
+                    self._set_baud(self._trial[0])
+                    self._trial = None
+                self._update(now)
+                self._refill_from_store()
+            time.sleep(TICK_S)
+
+    def _byte(self, b: int, now: float) -> None:
+        if b == scheduler.STOP_MARKER:
+            if self._stop_run < 0:
+                return
+            self._stop_run += 1
+            if self._stop_run >= scheduler.STOP_BURST_LEN:
+                self._emergency_stop()
+            return
+        self._stop_run = 0
+        if b == scheduler.FRAME_FLAG:
+            if self._state == 'data' and self._frame:
+                if self._esc or len(self._frame) < FRAME_OVERHEAD or scheduler.crc8(self._frame):
+                    self._nack(now)
+                else:
+                    self._accept(bytes(self._frame), now)
+            self._state, self._frame, self._esc = 'data', bytearray(), False
+            return
+        if self._state == 'hunt':
+            return
+        if b == scheduler.FRAME_ESC and not self._esc:
+            self._esc = True
+            return
+        if self._esc:
+            b ^= scheduler.FRAME_ESC_XOR
+            self._esc = False
+        if len(self._frame) >= FRAME_BUFFER_SIZE:
+            self._nack(now)
+            self._state = 'hunt'
+            return
+        self._frame.append(b)
+
+    def _nack(self, now: float) -> None:
+        self.stats.bad_frames += 1
+        if self._rx_seq is None:
+            return
+        if self._nack_at is not None and now - self._nack_at < NACK_REPEAT_S:
+            return
+        self._nack_at = now
+        self.stats.nacks += 1
+        self._line(f"NACK:{self._rx_seq}")
+
+    def _accept(self, f: bytes, now: float) -> None:
+        seq, ptype, payload = f[0], f[1], f[2:-1]
+        self._trial = None                           # The new rate works.
+        if ptype == scheduler.LINK_RESET_MARKER:
+            self._rx_seq, self._nack_at = (seq + 1) & 0xFF, None
+            return
+        if self._rx_seq is None:
+            self._rx_seq = seq
+        ahead = ((seq - self._rx_seq + 128) & 0xFF) - 128
+        if ahead < 0:
+            return                                   # Duplicate.
+        if ahead > 0:
+            self._nack(now)
+            return
+        self._rx_seq  = (self._rx_seq + 1) & 0xFF
+        self._nack_at = None
+        self.stats.packets[ptype] = self.stats.packets.get(ptype, 0) + 1
+        self._packet(ptype, payload, now)
+
+    def _push(self, delay: int, target: int, angle: int, arrival: int | None) -> None:
+        self._queue.append([delay, self._seq, target, angle, arrival])
+        self._queue.sort(key=lambda c: (c[0], c[1]))
+        self._seq += 1
+        self._accepted = (self._accepted + 1) & 0xFFFF
+        self.stats.accepted += 1
+        self.stats.queue_max = max(self.stats.queue_max, len(self._queue))
+        if arrival is not None and target != END_TARGET:
+            slack = delay - arrival
+            self.stats.slack.append(slack)
+            if slack < 0:
+                self.stats.missed += 1
+
+    def _packet(self, m: int, p: bytes, now: float) -> None:
+        s = scheduler
+        song_now = self._song_time(now) if self._synced else None
+        if m == s.GET_TIME_MARKER and len(p) == 1:
+            self._out(bytes([s.TIME_REPLY, p[0]]) + struct.pack('<I', self.micros(now)))
+        elif m == s.SYNC_MARKER and len(p) == 5:
+            self._ref_local = struct.unpack('>I', p[1:])[0]
+            self._ref_song  = 0
+            self._queue, self._accepted, self._freed = [], 0, 0
+            self._synced, self._store_feed = True, None
+            self.stats.song_us = 0
+            self._line("SYNCED")
+            self._report_credit()
+        elif m == s.CLOCK_ADJ_MARKER and len(p) == 12:
+            self._ref_local, self._ref_song, self._rate_ppm = struct.unpack('<Iii', p)
+        elif m == s.BATCH_MARKER and p:
+            n, base = struct.unpack_from('<BI', p)
+            if QUEUE_CAPACITY - len(self._queue) < n:
+                self.stats.rejected += n
+                self._line("ERROR: command buffer full")
+                return
+            for k in range(n):
+                target, angle = p[5 + 5 * k], p[6 + 5 * k]
+                offset = int.from_bytes(p[7 + 5 * k:10 + 5 * k], 'little')
+                self._push(base + offset, target, angle, song_now)
+        elif m == s.COMMAND_MARKER and len(p) == 6:
+            target, angle, delay = struct.unpack('<BBI', p)
+            if len(self._queue) >= QUEUE_CAPACITY:
+                self.stats.rejected += 1
+                self._line("ERROR: command buffer full")
+                return
+            self._push(delay, target, angle, song_now)
+        elif m == s.END_MARKER and len(p) == 4:
+            self._push(struct.unpack('<I', p)[0], END_TARGET, 0, song_now)
+        elif m == s.RESET_MARKER and len(p) == 2 * s.NUM_SERVOS:
+            for i in range(s.NUM_SERVOS):
+                self.servos[i] = struct.unpack_from('>h', p, 2 * i)[0]
+            self._line("RESET_DONE")
+        elif m == s.CALIBRATE_MARKER or m == s.PULSE_MARKER:
+            pass
+        elif m == s.POSE_DEFINE_MARKER and p:
+            self.poses[p[0]] = bytes(p[1:])
+        elif m == s.CAPS_MARKER:
+            self._line("CAPS:" + " ".join(str(b) for b in SUPPORTED_BAUDS))
+        elif m == s.BAUD_MARKER and len(p) == 4:
+            baud = struct.unpack('<I', p)[0]
+            if baud not in SUPPORTED_BAUDS:
+                self._line("ERROR: bad baud")
+                return
+            self._line(f"BAUD:{baud}")
+            self._trial = (self._baud, now)
+            self._set_baud(baud)
+        elif m == s.STATS_MARKER and len(p) == 1:
+            st, sat = self.stats, lambda v: min(int(v), 0xFFFF)
+            self._out(telemetry.STATS.pack(
+                telemetry.STATS_REPLY, *[sat(n) for n in st.lateness], sat(max(st.late_peak, 0)),
+                sat(st.loop_min if st.loop_min is not None else 0xFFFF), sat(st.loop_max),
+                0, 0, 0, 0, 0, 0, sat(st.bad_frames), min(st.queue_max, 255)))
+            if p[0] & 1:
+                st.lateness  = [0] * telemetry.LATENESS_BUCKETS
+                st.late_peak = 0
+                st.loop_min, st.loop_max = None, 0
+        elif m == s.ECHO_MARKER:
+            self._line("ECHO:" + p.hex().upper())
+        elif m in (s.STORE_BEGIN_MARKER, s.STORE_DATA_MARKER, s.STORE_END_MARKER):
+            self._store_packet(m, p)
+        elif m == s.STORE_QUERY_MARKER:
+            self._report_stored()
+        elif m == s.PLAY_STORED_MARKER and len(p) == 8:
+            if self._store is None:
+                self._line("PLAYING:none")
+                return
+            start, from_us = struct.unpack('<II', p)
+            self._ref_local, self._ref_song = start, from_us
+            self._queue, self._accepted, self._freed = [], 0, 0
+            self._synced, self._store_feed = True, [0, 0, from_us]
+            self._line(f"PLAYING:{len(self._store[1])}")
+        else:
+            self._line(f"ERROR: bad packet 0x{m:X}")
+
+    def _store_packet(self, m: int, p: bytes) -> None:
+        s = scheduler
+        if self._synced:
+            self._line("STORE:BUSY")
+        elif m == s.STORE_BEGIN_MARKER and len(p) == 10:
+            sid, count, end = struct.unpack('<IHI', p)
+            if count > STORE_CAPACITY:
+                self._line(f"STORE:FULL {STORE_CAPACITY}")
+                return
+            self._store, self._upload = None, (sid, bytearray(count * s.STORE_RECORD_SIZE), end)
+            self._line("STORE:0")
+        elif m == s.STORE_DATA_MARKER and self._upload and len(p) > 2:
+            index = struct.unpack_from('<H', p)[0]
+            data  = self._upload[1]
+            at    = index * s.STORE_RECORD_SIZE
+            if at + len(p) - 2 > len(data):
+                self._line("STORE:BAD")
+                return
+            data[at:at + len(p) - 2] = p[2:]
+            self._line(f"STORE:{index + (len(p) - 2) // s.STORE_RECORD_SIZE}")
+        elif m == s.STORE_END_MARKER and self._upload and len(p) == 1:
+            sid, data, end = self._upload
+            self._upload = None
+            if s.crc8(bytes(data)) != p[0]:
+                self._line("STORED:BAD")
+                return
+            records = [struct.unpack_from('<BB', data, i) + (int.from_bytes(data[i + 2:i + 5], 'little'),)
+                       for i in range(0, len(data), s.STORE_RECORD_SIZE)]
+            self._store = (sid, records, end)
+            self._report_stored()
+        else:
+            self._line("STORE:BAD")
+
+    def _report_stored(self) -> None:
+        if self._store is None:
+            self._line(f"STORED:none 0 {STORE_CAPACITY}")
+        else:
+            self._line(f"STORED:{self._store[0]:X} {len(self._store[1])} {STORE_CAPACITY}")
+
+    def _refill_from_store(self) -> None:
+        feed = self._store_feed
+        if feed is None or not self._synced:
+            return
+        records, end = self._store[1], self._store[2]
+        while len(self._queue) < QUEUE_CAPACITY:
+            if feed[0] == len(records):
+                self._push(end, END_TARGET, 0, None)
+                self._store_feed = None
+                return
+            target, angle, delta = records[feed[0]]
+            feed[0] += 1
+            feed[1] += delta
+            if feed[1] >= feed[2]:
+                self._push(feed[1], target, angle, None)
+
+    def _set_baud(self, baud: int) -> None:
+        self._baud  = baud
+        self._state = 'hunt'
+
+    def _update(self, now: float) -> None:
+        if self._last_tick is not None:
+            dt = now - self._last_tick
+            period = int(dt * 1e6)
+            self.stats.loop_max = max(self.stats.loop_max, period)
+            self.stats.loop_min = period if self.stats.loop_min is None else min(self.stats.loop_min, period)
+            if self._synced:
+                self.stats._depth_area += len(self._queue) * dt
+                self.stats._depth_time += dt
+        self._last_tick = now
+        if not self._synced:
+            return
+        song_now = self._song_time(now)
+        done = False
+        while self._queue and self._queue[0][0] <= song_now and not done:
+            delay, _, target, angle, _ = self._queue.pop(0)
+            self._freed += 1
+            if target == END_TARGET:
+                done = True
+                self.stats.song_us = song_now
+                continue
+            late = song_now - delay
+            self.stats.executed += 1
+            self.stats.max_late = max(self.stats.max_late, late)
+            if late > LATE_US:
+                self.stats.late += 1
+            b, edge = 0, telemetry.LATENESS_BUCKET0_US
+            while late >= edge and b < telemetry.LATENESS_BUCKETS - 1:
+                b, edge = b + 1, edge * 2
+            self.stats.lateness[b] += 1
+            self.stats.late_peak = max(self.stats.late_peak, late)
+            if target < scheduler.POSE_TARGET_BASE:
+                self.servos[target] = angle
+        if self._store_feed is None and (self._freed >= CREDIT_REPORT_STEP
+                                         or (self._freed and not self._queue)):
+            self._report_credit()
+        if done:
+            self._line("DONE")
+            self._synced = False
+
+    def _report_credit(self) -> None:
+        self._freed = 0
+        self._line(f"FREE:{QUEUE_CAPACITY - len(self._queue)} {self._accepted}")
+
+    def _emergency_stop(self) -> None:
+        self._stop_run = -1                          # Ignore the rest of the burst.
+        self._state    = 'hunt'
+        self._queue    = []
+        self._synced   = False
+        self._store_feed = None
+        self._line("STOPPED")
+
+def serve_pty(sim: SimulatedArduino) -> str:
+    """
+    Put sim behind a pseudo-terminal and return the device path to open
+    with pyserial. The pty passes bytes straight through, so the
+    simulator follows whatever rate the Pi side sets.
+    """
+    import tty                                       # POSIX only.
+    master, slave = os.openpty()
+    tty.setraw(slave)
+    sim.follow_baud = True
+    sim.timeout     = scheduler.READ_TIMEOUT
+
+    def to_board():
+        while not sim._closing.is_set():
+            try:
+                data = os.read(master, 4096)
+            except OSError:
+                return
+            sim.write(data)
+
+    def to_host():
+        while not sim._closing.is_set():
+            data = sim.read(4096)
+            if data:
+                os.write(master, data)
+
+    for fn in (to_board, to_host):
+        threading.Thread(target=fn, daemon=True).start()
+    return os.ttyname(slave)
@@ -0,0 +1,371 @@
+#!/usr/bin/env python3
+"""
+songcompiler.py
+
+
+Ahead-of-time compiler from songs/*.json + calibration.json to a flat,
+time-sorted command stream, cached on disk by content hash.
+
+Compiled file layout (little-endian):
+    header  : magic 'AGSC', version u16, record size u16, record count u32,
+              last record time u32 (us), source digest (32 bytes, sha256),
+              tempo row count u16, analysis size u32 (bytes)
+    records : count x (abs_us u32, servo u8, angle u8), sorted by abs_us;
+              servo >= 0x80 triggers pose (servo - 0x80), angle unused
+    tempo   : tempo rows x (beat f64, us f64, us per beat f64), the song's
+              compiled TempoMap breakpoints (see tempomap.py)
+    analysis: UTF-8 JSON of the song's SongAnalysis
+
+abs_us is in microseconds relative to the first beat of the song. A cached file is reused
+only while its digest matches the current song file, calibration file and
+FORMAT_VERSION, so editing either JSON file triggers a recompile.
+"""
+
+import hashlib                                       # Content hash for cache keys.
+import itertools                                     # Grouping records by time.
+import json                                          # JSON parsing for song files.
+import mmap                                          # Zero-copy access to compiled songs.
+import os                                            # Filesystem operations.
+import struct                                        # Binary record packing.
+import threading                                     # Compiles run from several request threads.
+
+import scheduler                                     # Command definitions and calibration.
+import tempomap                                      # Song tempo maps.
+import validator                                     # Servo conflict checks.
+
+# --- Configuration ------------------------------------------------------------
+
+FORMAT_VERSION = 6                                   # Bump when the layout or timing rules change.
+MAGIC          = b'AGSC'                             # File signature.
+HEADER         = struct.Struct('<4sHHII32sHI')       # magic, version, rec size, count, last us, digest,
+                                                     # tempo rows, analysis bytes.
+RECORD         = struct.Struct('<IBB')               # abs_us, servo, angle.
+TEMPO_ROW      = struct.Struct('<ddd')               # beat, us, us per beat.
+CACHE_DIR      = './cache'                           # Where compiled songs are kept.
+SONGS_DIR      = './songs'                           # Source song JSON files.
+AUTO_SHIFT_PICKS = False                             # Delay late picks (validator.shift_picks) when compiling.
+LOOKAHEAD_FRETS  = True                              # Press frets early (validator.preposition_frets).
+PEAK_WINDOW_US = 1_000_000                           # Window for the peak command rate.
+
+_loaded_calibration: bytes | None = None             # Digest of calibration behind command_map.
+_compile_lock = threading.RLock()                    # Pick/strum alternation and calibration are module state.
+
+# --- Compilation --------------------------------------------------------------
+
+def flatten_timeline(score: dict) -> list:
+    """
+    Expand section references into individual events, sorted by beat.
+    Tempo events ("bpm" instead of "cmd") are kept, shifted like the rest.
+    """
+    sections_map = score.get("sections", {})         # Named section definitions.
+    flat_events  = []
+    for ev in score["timeline"]:
+        beat = ev["beat"]; cmd = ev.get("cmd")
+        if cmd in sections_map:
+            for sub in sections_map[cmd]:
+                ev_copy = dict(sub)                  # Keep every field, including "duration".
+                ev_copy["beat"] = beat + sub["beat"]
+                flat_events.append(ev_copy)
+        else:
+            flat_events.append(ev)
+    flat_events.sort(key=lambda e: e["beat"])        # Stable: ties keep file order.
+    return flat_events
+
+def song_tempo(score: dict) -> tempomap.TempoMap:
+    """
+    The song's tempo map; scheduler.BPM if it sets no tempo.
+    """
+    return tempomap.TempoMap.from_score(score, flatten_timeline(score), scheduler.BPM)
+
+def build_records(score: dict, tempo: tempomap.TempoMap = None, lookahead: bool = None,
+                  report: dict = None) -> list:
+    """
+    Resolve every event into (abs_us, servo, angle) records, sorted by time.
+    Pick and strum alternation restart from the same state for every compile,
+    so a song always compiles to the same stream. tempo overrides the song's
+    own tempo map; lookahead (default LOOKAHEAD_FRETS) runs the fret
+    pre-positioning pass over the whole song, and fills report (if given)
+    with its results. One build runs at a time: the alternation state is
+    shared by the whole process.
+    """
+    with _compile_lock:
+        return _build_records(score, tempo, lookahead, report)
+
+def _build_records(score: dict, tempo, lookahead, report) -> list:
+    scheduler._last_pick_side.clear()
+    scheduler.StrumCommand._last_strum_up = False
+
+    tempo   = tempo or song_tempo(score)
+    lookahead = LOOKAHEAD_FRETS if lookahead is None else lookahead
+    records = []
+    notes   = []                                     # (start us, end us, records) per event.
+    for ev in flatten_timeline(score):
+        if "cmd" not in ev:
+            continue                                 # Tempo event, already in the map.
+        action = scheduler.resolve_command(ev)
+        duration = ev.get("duration", None)
+        recs = [(delay, servo, angle)
+                for servo, angle, delay in action.records(ev["beat"], duration, tempo)]
+        records.extend(recs)
+        notes.append((tempo.beat_to_us(ev["beat"]),
+                      tempo.beat_to_us(ev["beat"] + (duration if duration is not None else 1.0)),
+                      recs))
+    if lookahead:
+        records, result = validator.preposition_frets(notes)
+        if report is not None:
+            report.update(result)
+    else:
+        records.sort(key=lambda r: r[0])             # Stable: same-time moves keep their order.
+    return records
+
+def apply_poses(records: list, poses: list) -> list:
+    """
+    Replace every set of same-time moves that matches a pose with one pose
+    trigger. Larger poses are tried first. A servo moved twice at the same
+    time is never folded, so the last-write-wins order is kept.
+    """
+    order = sorted(range(len(poses)), key=lambda i: -len(poses[i]))
+    out = []
+    for t, group in itertools.groupby(records, key=lambda r: r[0]):
+        group = list(group)
+        for pid in order:
+            pose  = poses[pid]
+            moves = {}
+            for _, servo, angle in group:
+                moves.setdefault(servo, []).append(angle)
+            if all(moves.get(servo) == [angle] for servo, angle in pose.items()):
+                group = [r for r in group if r[1] not in pose]
+                out.append((t, scheduler.POSE_TARGET_BASE + pid, 0))
+        out.extend(group)
+    return out
+
+# --- Analysis -----------------------------------------------------------------
+
+class SongAnalysis:
+    """
+    Facts about one compiled song, worked out once at compile time and
+    stored with it, so playback and the web UI never walk the events.
+
+    Times are us after the first beat. end_us is when the END marker runs,
+    i.e. when the Arduino reports DONE.
+    """
+    FIELDS = ("last_us", "end_us", "bpm", "events", "commands", "peak_per_s",
+              "sections", "servo_moves", "strings", "chords", "conflicts")
+
+    def __init__(self, **fields):
+        self.last_us     = fields["last_us"]         # Time of the final command.
+        self.end_us      = fields["end_us"]          # END marker time (last + END_SLACK).
+        self.bpm         = fields["bpm"]             # Tempo at beat 0.
+        self.events      = fields["events"]          # Timeline events after section expansion.
+        self.commands    = fields["commands"]        # Commands streamed (after pose folding).
+        self.peak_per_s  = fields["peak_per_s"]      # Most commands in any PEAK_WINDOW_US.
+        self.sections    = fields["sections"]        # [{"name", "beat", "us"}] in timeline order.
+        self.servo_moves = fields["servo_moves"]     # {servo index (str): moves}.
+        self.strings     = fields["strings"]         # Strings whose pick leaves neutral.
+        self.chords      = fields["chords"]          # Chord commands used, sorted.
+        self.conflicts   = fields["conflicts"]       # validator.find_conflicts() count.
+
+    @classmethod
+    def build(cls, score: dict, tempo: tempomap.TempoMap, moves: list, stream: list,
+              conflicts: int) -> "SongAnalysis":
+        """
+        moves are the per-servo records, stream the records actually sent
+        (pose triggers in place of the moves they cover); both time-sorted.
+        """
+        events  = flatten_timeline(score)
+        picking = scheduler.calibration["picking"]
+        picked  = {(servo, angle) for _, servo, angle in moves}
+        strings = [name for name, p in picking.items()
+                   if any(s == int(p["servo"]) and a != int(p["neutral"]) for s, a in picked)]
+        sections_map = score.get("sections", {})
+        sections = [{"name": ev["cmd"], "beat": ev["beat"], "us": tempo.beat_to_us(ev["beat"])}
+                    for ev in sorted(score["timeline"], key=lambda e: e["beat"])
+                    if ev.get("cmd") in sections_map]
+        servo_moves = {}
+        for _, servo, _ in moves:
+            servo_moves[str(servo)] = servo_moves.get(str(servo), 0) + 1
+        peak, lo = 0, 0
+        for hi in range(len(stream)):                # Sliding window over send times.
+            while stream[hi][0] - stream[lo][0] >= PEAK_WINDOW_US:
+                lo += 1
+            peak = max(peak, hi - lo + 1)
+        last_us = stream[-1][0] if stream else 0
+        return cls(
+            last_us=last_us,
+            end_us=last_us + scheduler.END_SLACK * 1000,
+            bpm=tempo.initial_bpm,
+            events=sum(1 for ev in events if "cmd" in ev),
+            commands=len(stream),
+            peak_per_s=peak * 1_000_000 / PEAK_WINDOW_US,
+            sections=sections,
+            servo_moves=dict(sorted(servo_moves.items(), key=lambda kv: int(kv[0]))),
+            strings=strings,
+            chords=sorted({ev["cmd"] for ev in events if ev.get("cmd", "").startswith("Chord_")}),
+            conflicts=conflicts,
+        )
+
+    def to_dict(self) -> dict:
+        return {name: getattr(self, name) for name in self.FIELDS}
+
+    @property
+    def length_ms(self) -> float:
+        return self.end_us / 1000.0
+
+    def section_at(self, us: float) -> str | None:
+        """
+        Name of the section playing at song time us, if any.
+        """
+        current = None
+        for sec in self.sections:
+            if sec["us"] > us:
+                break
+            current = sec["name"]
+        return current
+
+def source_digest(song_path: str, calibration_path: str) -> bytes:
+    """
+    Hash everything a compiled song depends on.
+    """
+    h = hashlib.sha256()
+    h.update(struct.pack('<H??', FORMAT_VERSION, AUTO_SHIFT_PICKS, LOOKAHEAD_FRETS))
+    for path in (song_path, calibration_path):
+        with open(path, "rb") as f:
+            h.update(hashlib.sha256(f.read()).digest())
+    return h.digest()
+
+def _sync_calibration(calibration_path: str) -> None:
+    # Rebuild command_map if calibration.json changed since it was loaded.
+    global _loaded_calibration
+    with open(calibration_path, "rb") as f:
+        digest = hashlib.sha256(f.read()).digest()
+    if digest != _loaded_calibration:
+        scheduler.reload_calibration(calibration_path)
+        _loaded_calibration = digest
+
+def cache_path(song_name: str, digest: bytes, cache_dir: str = CACHE_DIR) -> str:
+    return os.path.join(cache_dir, f"{song_name}.{digest.hex()[:16]}.agsc")
+
+def compile_song(song_name: str, songs_dir: str = SONGS_DIR, cache_dir: str = CACHE_DIR,
+                 calibration_path: str = scheduler.CALIBRATION_PATH) -> str:
+    """
+    Return the path of the compiled stream for a song, compiling it first if
+    no up-to-date copy is cached. Older copies of the same song are removed.
+    """
+    song_path = os.path.join(songs_dir, f"{song_name}.json")
+    digest    = source_digest(song_path, calibration_path)
+    path      = cache_path(song_name, digest, cache_dir)
+    if os.path.isfile(path):
+        return path
+    with _compile_lock:
+        if os.path.isfile(path):                     # Another thread compiled it while we waited.
+            return path
+        return _compile_song(song_name, song_path, digest, path, cache_dir, calibration_path)
+
+def _compile_song(song_name: str, song_path: str, digest: bytes, path: str, cache_dir: str,
+                  calibration_path: str) -> str:
+    _sync_calibration(calibration_path)
+    with open(song_path, "r") as f:
+        score = json.load(f)
+    tempo   = song_tempo(score)
+    lookahead = {}
+    records = build_records(score, tempo, report=lookahead)
+    if scheduler.DEBUG and lookahead.get("fretted"):
+        print(f"[compile] {song_name}: {lookahead['settled']} of {lookahead['fretted']} fretted notes "
+              f"settled by their pick (was {lookahead['was']}), "
+              f"picks {lookahead['advance_us'] / 1000:.1f} ms earlier")
+    if AUTO_SHIFT_PICKS:
+        records, shifts = validator.shift_picks(records)
+        if scheduler.DEBUG and shifts:
+            print(f"[compile] {song_name}: {len(shifts)} picks delayed until their servo is free")
+    conflicts = validator.find_conflicts(records)
+    if scheduler.DEBUG:
+        for c in conflicts:
+            print(f"[compile] {song_name}: {validator.format_conflict(c).strip()}")
+    moves    = records
+    records  = apply_poses(records, scheduler.build_poses())
+    analysis = SongAnalysis.build(score, tempo, moves, records, len(conflicts))
+    last_us  = analysis.last_us
+    if analysis.end_us > scheduler.MAX_DELAY_US:
+        raise ValueError(f"{song_name}: song is longer than the Arduino clock range")
+    blob = json.dumps(analysis.to_dict(), separators=(",", ":")).encode()
+
+    os.makedirs(cache_dir, exist_ok=True)
+    tmp = f"{path}.{os.getpid()}.tmp"                # Other processes may compile the same song.
+    with open(tmp, "wb") as f:
+        rows = tempo.table()
+        f.write(HEADER.pack(MAGIC, FORMAT_VERSION, RECORD.size, len(records), last_us, digest,
+                            len(rows), len(blob)))
+        for rec in records:
+            f.write(RECORD.pack(*rec))
+        for row in rows:
+            f.write(TEMPO_ROW.pack(*row))
+        f.write(blob)
+    os.replace(tmp, path)                            # Readers never see a half-written file.
+
+    prefix = f"{song_name}."
+    for name in os.listdir(cache_dir):               # Drop stale compiles of this song.
+        stale = os.path.join(cache_dir, name)
+        if name.startswith(prefix) and name.endswith(".agsc") and stale != path \
+                and name[len(prefix):-5].isalnum():
+            os.remove(stale)
+    if scheduler.DEBUG:
+        print(f"[compile] {song_name}: {len(records)} records, last at {last_us / 1000:.1f} ms")
+    return path
+
+# --- Loading ------------------------------------------------------------------
+
+class CompiledSong:
+    """
+    Memory-mapped view of a compiled song file.
+    """
+    def __init__(self, path: str):
+        self.path = path
+        with open(path, "rb") as f:
+            self._mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version, rec_size, count, last_us, digest, rows, blob = HEADER.unpack_from(self._mm, 0)
+        if magic != MAGIC or version != FORMAT_VERSION or rec_size != RECORD.size:
+            self._mm.close()
+            raise ValueError(f"{path}: not a version {FORMAT_VERSION} compiled song")
+        self.count   = count                         # Number of records.
+        self.last_us = last_us                       # Time of the final record (us).
+        self.digest  = digest                        # Source digest it was built from.
+        start = HEADER.size + count * RECORD.size
+        self.tempo = tempomap.TempoMap.from_table(   # Beat <-> us for progress displays.
+            [TEMPO_ROW.unpack_from(self._mm, start + i * TEMPO_ROW.size) for i in range(rows)])
+        start += rows * TEMPO_ROW.size
+        self.analysis = SongAnalysis(**json.loads(self._mm[start:start + blob]))
+
+    def __len__(self) -> int:
+        return self.count
+
+    def __iter__(self):
+        """
+        Yield (abs_us, servo, angle) records straight from the mapping.
+        """
+        view = memoryview(self._mm)[HEADER.size:HEADER.size + self.count * RECORD.size]
+        try:
+            yield from RECORD.iter_unpack(view)
+        finally:
+            view.release()
+
+    def close(self) -> None:
+        self._mm.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+def load_song(song_name: str, songs_dir: str = SONGS_DIR, cache_dir: str = CACHE_DIR) -> CompiledSong:
+    """
+    Compile (if needed) and map a song for streaming.
+    """
+    return CompiledSong(compile_song(song_name, songs_dir, cache_dir))
+
+if __name__ == '__main__':
+    # Precompile every song in the library.
+    for name in sorted(os.listdir(SONGS_DIR)):
+        if name.endswith('.json'):
+            with load_song(name[:-5]) as song:
+                print(f"{name[:-5]}: {len(song)} records, {song.last_us / 1000:.1f} ms")
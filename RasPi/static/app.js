@@ -10,14 +10,27 @@ const nowTitle   = document.getElementById('now-title');
 
 // state
 let selectedSong = null;
-let progTimer    = null;
+let playingSong  = null;
 
 // --------------- song-card factory  (old tap logic) ---------------
-function makeCard(name) {
+function makeCard(song) {
+  const name = song.name;
   const card = document.createElement('div');
   card.className  = 'song-card';
   card.textContent = name;
 
+  if(song.length_ms!==undefined){       // library metadata line
+    const meta = document.createElement('div');
+    const secs = Math.round(song.length_ms/1000);
+    meta.className   = 'song-meta';
+    meta.textContent = `${Math.floor(secs/60)}:${String(secs%60).padStart(2,'0')} · ${song.bpm} BPM`
+                     + (song.chords.length ? ` · ${song.chords.map(c=>c.replace('Chord_','')).join(' ')}` : '')
+                     + (song.status==='conflicts' ? ` · ${song.conflicts} conflicts` : '');
+    card.appendChild(meta);
+  }else if(song.status==='error'){
+    card.classList.add('broken');
+  }
+
   /* OLD BEHAVIOUR - a simple tap on finger-up selects the card.
      No pointer-capture, no drag detection exactly as before.   */
   card.addEventListener('pointerup', () => select(card, name));
@@ -65,31 +78,38 @@ async function safeRun(btn,fn){
   try{await fn();}finally{btn.style.pointerEvents='';}
 }
 
-// ----------------- polling -----------------
-async function pollStatus(){
-  try{
-    const d=await fetchJSON('/status');
-    statusTxt.textContent = d.state==='playing' ? `Playing: ${d.song}` : 'Idle';
-
-    if(d.state==='playing'){            // enter playing view
-      nowTitle.textContent = `Now Playing: ${d.song}`;
-      showPlaying(true);
-      if(!progTimer) progTimer=setInterval(pollProgress,120);
-      playBtn.disabled=true;
-    }else{                              // back to library
-      showPlaying(false);
-      clearInterval(progTimer); progTimer=null;
-      playBtn.disabled=!selectedSong;
-    }
-  }catch{statusTxt.textContent='Status error';}
+// ----------------- server push -----------------
+// One EventSource for the whole page: the Pi sends 'state' when playback
+// starts or ends and 'progress' as the robot reports commands run. After a
+// dropped connection the browser reconnects by itself and the server
+// replays the latest of each, so nothing is polled.
+function applyState(d){
+  playingSong = d.state==='playing' ? d.song : null;
+  statusTxt.textContent = playingSong ? `Playing: ${playingSong}` : 'Idle';
+
+  if(playingSong){                      // enter playing view
+    nowTitle.textContent = `Now Playing: ${playingSong}`;
+    ringFg.style.strokeDashoffset = 339;
+    showPlaying(true);
+    playBtn.disabled=true;
+  }else{                                // back to library
+    showPlaying(false);
+    playBtn.disabled=!selectedSong;
+  }
 }
 
-async function pollProgress(){
-  try{
-    const {pct} = await fetchJSON('/progress');
-    const clamped = Math.min(1,Math.max(0,pct));
-    ringFg.style.strokeDashoffset = 339 * (1-clamped);
-  }catch{/* ignore */}
+function applyProgress(d){
+  const clamped = Math.min(1,Math.max(0,d.pct));
+  ringFg.style.strokeDashoffset = 339 * (1-clamped);
+  if(playingSong)
+    nowTitle.textContent = `Now Playing: ${playingSong}` + (d.section ? ` · ${d.section}` : '');
+}
+
+function connectEvents(){
+  const es = new EventSource('/events');
+  es.addEventListener('state',    e=>applyState(JSON.parse(e.data)));
+  es.addEventListener('progress', e=>applyProgress(JSON.parse(e.data)));
+  es.onerror = ()=>{ if(es.readyState!==EventSource.OPEN) statusTxt.textContent='Reconnecting…'; };
 }
 
 // ----------------- init -----------------
@@ -97,12 +117,11 @@ async function init(){
   // load songs
   try{
     const songs = await fetchJSON('/songs');
-    songs.sort((a,b)=>a.localeCompare(b,undefined,{sensitivity:'base'}))
-         .forEach(n=>list.appendChild(makeCard(n)));
+    songs.sort((a,b)=>a.name.localeCompare(b.name,undefined,{sensitivity:'base'}))
+         .forEach(s=>list.appendChild(makeCard(s)));
   }catch{statusTxt.textContent='Error loading songs';}
 
-  pollStatus();
-  setInterval(pollStatus,1000);
+  connectEvents();
 }
 
 window.addEventListener('DOMContentLoaded',init);
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""
+telemetry.py
+
+
+Decoder for the Arduino's binary telemetry records (see Telemetry.h).
+
+Record layout (12 bytes, little-endian):
+    marker 0xCF, type u8, seq u8, target u8, angle u8, depth u8,
+    arg i16, time u32
+
+The meaning of target, angle, arg and time depends on the event type.
+
+The reply to a STATS packet is another binary unit on the same stream
+(40 bytes, little-endian; see RemoteControl::reportStats()):
+    marker 0xCB, lateness u16 x 8, late max u16, loop min u16, loop max u16,
+    parse max u16, burst max u16, I2C sent u16, I2C max u16, I2C busy u32,
+    RX full u16, bad frames u16, queue high u8
+"""
+
+import struct                                        # Binary record unpacking.
+
+# --- Configuration ------------------------------------------------------------
+
+MARKER = 0xCF                                        # First byte of every record.
+RECORD = struct.Struct('<BBBBBBhI')                  # marker, type, seq, target, angle, depth, arg, time.
+TIME_REPLY      = 0xCD                               # Other binary unit on the stream (clock reply).
+TIME_REPLY_SIZE = 6
+STATS_REPLY     = 0xCB                               # Timing counters (reply to STATS).
+STATS = struct.Struct('<B8H7HIHHB')
+LATENESS_BUCKET0_US = 64                             # Bucket k holds < 64 << k us; the last, the rest.
+LATENESS_BUCKETS    = 8
+
+EXECUTED = 0x06                                      # Event type of a command run (counted for progress).
+
+NACK_REASONS = {1: "bad CRC", 2: "frame too long", 3: "frame missing"}
+
+# Event type -> (name, formatter). Formatters take the decoded record dict.
+EVENTS = {
+    0x01: ("BOOT",      lambda r: f"I2C clock {r['arg']} kHz"),
+    0x02: ("MAP",       lambda r: f"servo {r['target']} -> board {r['angle']}, channel {r['arg']}"),
+    0x03: ("SYNC",      lambda r: f"song time 0 at micros() {r['time']}"),
+    0x04: ("RECEIVED",  lambda r: f"T={r['target']} A={r['angle']} D={r['time']} us, depth {r['depth']}"),
+    0x05: ("BATCH",     lambda r: f"N={r['target']} D={r['time']} us, depth {r['depth']}"),
+    0x06: ("EXECUTED",  lambda r: f"T={r['target']} A={r['angle']} D={r['time']} us, "
+                                  f"late {r['arg']} us, depth {r['depth']}"),
+    0x07: ("CLOCK_ADJ", lambda r: f"ref song {struct.unpack('<i', struct.pack('<I', r['time']))[0]} us, "
+                                  f"rate {r['arg']} ppm"),
+    0x08: ("RESET",     lambda r: "servos at RESET angles"),
+    0x09: ("DONE",      lambda r: f"end marker at {r['time']} us"),
+    0x0A: ("DROPPED",   lambda r: f"{r['arg']} records lost (TX busy)"),
+    0x0B: ("NACK",      lambda r: f"want frame {r['target']}, "
+                                  f"{NACK_REASONS.get(r['angle'], r['angle'])}, {r['arg']} bad so far"),
+    0x0C: ("BAUD",      lambda r: f"serial now {r['time']} baud"),
+    0x0D: ("I2C",       lambda r: f"{r['time']} writes sent, {r['arg']} refused at start, "
+                                  f"queue peak {r['target']}, {r['angle']} stalls"),
+    0x0E: ("WRITES",    lambda r: f"{r['time']} unchanged servo writes skipped "
+                                  f"({r['arg'] / 10:.1f} % of moves)"),
+}
+
+def decode(raw: bytes) -> dict:
+    """
+    Unpack one record into a dict of its fields plus the event name.
+    """
+    marker, typ, seq, target, angle, depth, arg, t = RECORD.unpack(raw)
+    if marker != MARKER:
+        raise ValueError(f"not a telemetry record: 0x{marker:02X}")
+    name = EVENTS.get(typ, (f"EVENT_{typ:02X}", None))[0]
+    return {"type": typ, "name": name, "seq": seq, "target": target,
+            "angle": angle, "depth": depth, "arg": arg, "time": t}
+
+def decode_stats(raw: bytes) -> dict:
+    """
+    Unpack a STATS reply. lateness maps each bucket's upper edge in us
+    (None for the last, open bucket) to the commands that ran in it; times
+    are us, saturated at 65535. loop_min is None before any loop was timed.
+    """
+    f = STATS.unpack(raw)
+    if f[0] != STATS_REPLY:
+        raise ValueError(f"not a stats reply: 0x{f[0]:02X}")
+    buckets = f[1:1 + LATENESS_BUCKETS]
+    (late_max, loop_min, loop_max, parse_max, burst_max, i2c_sent, i2c_max,
+     i2c_busy, rx_full, bad_frames, queue_high) = f[1 + LATENESS_BUCKETS:]
+    edges = [LATENESS_BUCKET0_US << k for k in range(LATENESS_BUCKETS - 1)] + [None]
+    return {
+        "lateness":    list(zip(edges, buckets)),
+        "executed":    sum(buckets),
+        "late_max_us": late_max,
+        "loop_min_us": None if loop_max == 0 and loop_min == 0xFFFF else loop_min,
+        "loop_max_us": loop_max,
+        "parse_max_us": parse_max,
+        "burst_max_us": burst_max,
+        "i2c_sent":    i2c_sent,
+        "i2c_max_us":  i2c_max,
+        "i2c_busy_us": i2c_busy,
+        "rx_full":     rx_full,
+        "bad_frames":  bad_frames,
+        "queue_high":  queue_high,
+    }
+
+def format_record(rec: dict) -> str:
+    """
+    Render a decoded record as one log line.
+    """
+    fmt = EVENTS.get(rec["type"], (None, None))[1]
+    detail = fmt(rec) if fmt else f"T={rec['target']} A={rec['angle']} arg={rec['arg']} time={rec['time']}"
+    return f"#{rec['seq']:3d} {rec['name']}: {detail}"
+
+class Decoder:
+    """
+    Formats records in arrival order and reports sequence gaps, which mean
+    records were lost on the way (the Arduino also counts drops it knows of).
+    """
+    def __init__(self):
+        self.expected = None                         # Next sequence number.
+        self.records  = 0                            # Records decoded.
+        self.missing  = 0                            # Records inferred lost from gaps.
+
+    def feed(self, raw: bytes) -> list:
+        """
+        Decode one record; returns the log lines it produces.
+        """
+        rec = decode(raw)
+        lines = []
+        if self.expected is not None and rec["seq"] != self.expected:
+            gap = (rec["seq"] - self.expected) & 0xFF
+            self.missing += gap
+            lines.append(f"[telemetry] sequence gap: {gap} records missing")
+        self.expected = (rec["seq"] + 1) & 0xFF
+        self.records += 1
+        lines.append(format_record(rec))
+        return lines
+
+if __name__ == '__main__':
+    # Decode a raw capture of the serial stream: python3 telemetry.py capture.bin
+    import sys
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+    dec = Decoder()
+    i = 0
+    while i < len(data):
+        if data[i] == MARKER and i + RECORD.size <= len(data):
+            for line in dec.feed(data[i:i + RECORD.size]):
+                print(line)
+            i += RECORD.size
+        elif data[i] == TIME_REPLY:                  # Clock probe reply, not telemetry.
+            i += TIME_REPLY_SIZE
+        elif data[i] == STATS_REPLY and i + STATS.size <= len(data):
+            print("STATS:", decode_stats(data[i:i + STATS.size]))
+            i += STATS.size
+        else:
+            end = data.find(b'\n', i)
+            end = len(data) if end < 0 else end
+            text = data[i:end].decode('utf-8', 'replace').strip()
+            if text:
+                print(text)
+            i = end + 1
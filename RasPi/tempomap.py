@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""
+tempomap.py
+
+
+Beat -> microsecond mapping for songs whose tempo changes.
+
+A song may give its tempo as a top-level "bpm", a "tempo" list, and/or
+tempo events in its timeline or sections (events with "bpm" instead of
+"cmd", placed like any other event):
+
+    "tempo": [ {"beat": 0,  "bpm": 120},
+               {"beat": 32, "bpm": 90},
+               {"beat": 48, "bpm": 140, "ramp": true} ]
+
+An entry holds its bpm until the next one. With "ramp" the tempo instead
+changes linearly (in BPM per beat) from the previous entry up to this one.
+The map is compiled once into breakpoints of a piecewise-linear function;
+ramps are split into RAMP_STEP_BEATS steps whose durations are exact, so
+breakpoint times carry no accumulated error. A lookup is one bisect plus
+one multiply-add.
+"""
+
+import bisect                                        # O(log n) breakpoint lookup.
+import math                                          # Exact ramp step durations.
+
+# --- Configuration ------------------------------------------------------------
+
+RAMP_STEP_BEATS = 0.25                               # Resolution of tempo ramps.
+US_PER_MINUTE   = 60_000_000.0
+
+class TempoMap:
+    """
+    Piecewise-linear beat -> us function with time 0 at beat 0.
+    """
+    def __init__(self, points: list, default_bpm: float):
+        """
+        points: (beat, bpm, ramp) tuples in any order; default_bpm applies
+        before the first point (and everywhere if there are none).
+        """
+        points = sorted(points, key=lambda p: p[0])
+        if not points or points[0][0] > 0:
+            points.insert(0, (0.0, float(default_bpm), False))
+        for _, bpm, _ in points:
+            if bpm <= 0:
+                raise ValueError(f"Tempo must be positive, got {bpm} BPM")
+
+        beats, times = [float(points[0][0])], [0.0]
+        slopes = []                                  # us per beat after each breakpoint.
+        for (b0, bpm0, _), (b1, bpm1, ramp) in zip(points, points[1:]):
+            if b1 <= b0:
+                continue                             # Same-beat entries: last one wins below.
+            if not ramp or bpm1 == bpm0:
+                self._append(beats, times, slopes, b1, US_PER_MINUTE / bpm0)
+                continue
+            k = (bpm1 - bpm0) / (b1 - b0)            # BPM change per beat.
+            s = b0
+            while s < b1:
+                e = min(b1, s + RAMP_STEP_BEATS)
+                dur = US_PER_MINUTE / k * math.log((bpm0 + k * (e - b0)) / (bpm0 + k * (s - b0)))
+                self._append(beats, times, slopes, e, dur / (e - s))
+                s = e
+        slopes.append(US_PER_MINUTE / points[-1][1])  # Last tempo holds from the end on.
+
+        # Shift so beat 0 is time 0 even when the first point is at a negative beat.
+        zero = self._eval(beats, times, slopes, 0.0)
+        self.beats  = beats
+        self.times  = [t - zero for t in times]
+        self.slopes = slopes
+        self.points = points                         # Source entries, for reports.
+
+    @staticmethod
+    def _append(beats, times, slopes, beat, us_per_beat):
+        slopes.append(us_per_beat)
+        times.append(times[-1] + (beat - beats[-1]) * us_per_beat)
+        beats.append(beat)
+
+    @staticmethod
+    def _eval(beats, times, slopes, beat):
+        i = max(0, bisect.bisect_right(beats, beat) - 1)
+        return times[i] + (beat - beats[i]) * slopes[i]
+
+    @classmethod
+    def constant(cls, bpm: float) -> "TempoMap":
+        return cls([], bpm)
+
+    @classmethod
+    def from_score(cls, score: dict, events: list, default_bpm: float) -> "TempoMap":
+        """
+        Collect a song's tempo from its "bpm", "tempo" list and the tempo
+        events among its flattened timeline events.
+        """
+        bpm    = float(score.get("bpm", default_bpm))
+        points = [(float(p["beat"]), float(p["bpm"]), bool(p.get("ramp", False)))
+                  for p in score.get("tempo", [])]
+        points += [(float(e["beat"]), float(e["bpm"]), bool(e.get("ramp", False)))
+                   for e in events if "bpm" in e]
+        return cls(points, bpm)
+
+    def beat_to_us(self, beat: float) -> int:
+        """
+        Song time in us of a (possibly fractional, possibly negative) beat.
+        """
+        i = max(0, bisect.bisect_right(self.beats, beat) - 1)
+        return int(round(self.times[i] + (beat - self.beats[i]) * self.slopes[i]))
+
+    def span_us(self, beat: float, beats: float) -> int:
+        """
+        Duration in us of `beats` beats starting at `beat`.
+        """
+        return self.beat_to_us(beat + beats) - self.beat_to_us(beat)
+
+    def us_to_beat(self, us: float) -> float:
+        """
+        Inverse of beat_to_us, for progress displays.
+        """
+        i = max(0, bisect.bisect_right(self.times, us) - 1)
+        return self.beats[i] + (us - self.times[i]) / self.slopes[i]
+
+    def bpm_at(self, beat: float) -> float:
+        i = max(0, bisect.bisect_right(self.beats, beat) - 1)
+        return US_PER_MINUTE / self.slopes[i]
+
+    @property
+    def initial_bpm(self) -> float:
+        return self.bpm_at(0.0)
+
+    def scaled(self, factor: float) -> "TempoMap":
+        """
+        The same map with every tempo multiplied by factor.
+        """
+        points = [(b, bpm * factor, ramp) for b, bpm, ramp in self.points]
+        return TempoMap(points, points[0][1])
+
+    def table(self) -> list:
+        # (beat, us, us per beat) breakpoints, as stored in compiled songs.
+        return list(zip(self.beats, self.times, self.slopes))
+
+    @classmethod
+    def from_table(cls, rows: list) -> "TempoMap":
+        """
+        Rebuild a map from the breakpoints stored in a compiled song.
+        """
+        m = cls.__new__(cls)
+        m.beats  = [r[0] for r in rows]
+        m.times  = [r[1] for r in rows]
+        m.slopes = [r[2] for r in rows]
+        m.points = [(b, US_PER_MINUTE / s, False) for b, _, s in rows]
+        return m
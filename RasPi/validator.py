@@ -0,0 +1,322 @@
+#!/usr/bin/env python3
+"""
+validator.py
+
+
+Offline checks that a song is physically playable, run on the flattened
+(abs_us, servo, angle) records before they are compiled.
+
+Each servo is modelled as busy from the moment it is commanded until it
+has slewed to the new angle and settled:
+
+    busy_us = |new - old| / deg_per_s + settle_ms
+
+using the per-servo "slew" entries of calibration.json. Two kinds of
+conflict are reported:
+
+    slew     a servo is commanded again before its previous move finished
+    overlap  a fret servo (shared by two frets) is pressed to a new fret
+             while still holding the other one down
+
+The tempo search rebuilds the song with its tempo map scaled to find the
+fastest starting BPM with no conflicts, and shift_picks() can delay pick moves by a few ms so
+each pick starts once its servo is free.
+
+preposition_frets() is the compiler's look-ahead pass: it moves each fret
+press as early as its string and servo allow, so the fret is down (or much
+closer to it) by the time the pick arrives.
+"""
+
+import scheduler                                     # Calibration and musical primitives.
+
+# --- Configuration ------------------------------------------------------------
+
+DEFAULT_SLEW      = {"deg_per_s": 600, "settle_ms": 5}  # 0.1 s / 60 deg hobby servo.
+MAX_PICK_SHIFT_US = 20_000                           # Largest delay shift_picks() applies.
+TEMPO_RANGE       = (20, 400)                        # BPM bounds for the tempo search.
+MAX_FRET_LEAD_US  = 250_000                          # Furthest preposition_frets() moves a press ahead.
+PICK_LEAD_US      = 50_000                           # Pick delay after a fret press in the commands.
+
+# --- Servo model --------------------------------------------------------------
+
+def slew_params(servo: int) -> tuple:
+    """
+    (deg_per_s, settle_us) for a servo; calibration.json may override the
+    "default" entry per servo index under "slew".
+    """
+    table = scheduler.calibration.get("slew", {})
+    p = table.get(str(servo), table.get("default", DEFAULT_SLEW))
+    return float(p["deg_per_s"]), int(p["settle_ms"] * 1000)
+
+def travel_us(servo: int, old: int, new: int) -> int:
+    """
+    Time a servo is busy moving from old to new degrees and settling.
+    """
+    rate, settle = slew_params(servo)
+    return int(abs(new - old) / rate * 1_000_000) + settle
+
+def pick_servos() -> set:
+    return {int(p["servo"]) for p in scheduler.calibration["picking"].values()}
+
+def occupancy(records: list) -> dict:
+    """
+    Per-servo timeline of (start_us, end_us, from_angle, to_angle, held)
+    moves, starting from the neutral pose the Arduino holds after RESET.
+    Moves of one servo at the same time collapse into the last, as on the
+    Arduino; held is what the servo holds just before to_angle, which is
+    neutral if one of the collapsed moves was a release.
+    """
+    neutral  = scheduler.neutral_angles(scheduler.calibration)
+    timeline = {}
+    for t, servo, new in records:
+        if servo >= scheduler.NUM_SERVOS:
+            continue                                 # Pose triggers and sentinels.
+        moves = timeline.setdefault(servo, [])
+        if moves and moves[-1][0] == t:
+            _, _, old, last, held = moves.pop()
+            if last == neutral[servo]:
+                held = last                          # Released first, by sequence.
+        else:
+            old = held = moves[-1][3] if moves else neutral[servo]
+        moves.append((t, t + travel_us(servo, old, new), old, new, held))
+    return timeline
+
+def find_conflicts(records: list) -> list:
+    """
+    Every slew and overlap conflict in time-sorted (abs_us, servo, angle)
+    records, as dicts ordered by time.
+    """
+    neutral   = scheduler.neutral_angles(scheduler.calibration)
+    picks     = pick_servos()
+    conflicts = []
+    for servo, moves in occupancy(records).items():
+        prev = None
+        for start, end, old, new, held in moves:
+            if prev is not None and start < prev[1] and new != old:
+                conflicts.append({
+                    "kind": "slew", "servo": servo, "time_us": start, "angle": new,
+                    "prev_time_us": prev[0], "shortfall_us": prev[1] - start,
+                })
+            if servo not in picks and held != neutral[servo] and new not in (held, neutral[servo]):
+                conflicts.append({
+                    "kind": "overlap", "servo": servo, "time_us": start, "angle": new,
+                    "prev_time_us": prev[0] if prev else 0, "held_angle": held,
+                })
+            prev = (start, end)
+    conflicts.sort(key=lambda c: (c["time_us"], c["servo"]))
+    return conflicts
+
+# --- Repairs ------------------------------------------------------------------
+
+def shift_picks(records: list, max_shift_us: int = MAX_PICK_SHIFT_US) -> tuple:
+    """
+    Delay pick moves that would start while their servo is still busy, by
+    at most max_shift_us each. Fret moves are never touched.
+    Returns (new records sorted by time, list of (servo, old_us, new_us)).
+    """
+    neutral = scheduler.neutral_angles(scheduler.calibration)
+    picks   = pick_servos()
+    state   = {}                                     # servo -> (raw t, shifted t, angle before, free_at before).
+    angle   = {}
+    free_at = {}
+    shifts  = []
+    out     = []
+    for t, servo, new in records:
+        if servo in picks:
+            last = state.get(servo)
+            if last is not None and last[0] == t:    # Same-time move: replaces the last one.
+                raw, t, old, ready = last
+            else:
+                raw, old, ready = t, angle.get(servo, neutral[servo]), free_at.get(servo, 0)
+                if new != old and t < ready and ready - t <= max_shift_us:
+                    shifts.append((servo, t, ready))
+                    t = ready
+            state[servo]   = (raw, t, old, ready)
+            free_at[servo] = t + travel_us(servo, old, new)
+            angle[servo]   = new
+        out.append((t, servo, new))
+    out.sort(key=lambda r: r[0])                     # Stable: untouched order is kept.
+    return out, shifts
+
+def preposition_frets(notes: list, max_lead_us: int = MAX_FRET_LEAD_US) -> tuple:
+    """
+    Look-ahead over the whole song. notes holds (start_us, end_us, records)
+    per timeline event, records being that event's (abs_us, servo, angle)
+    moves. Each fret press moves back to the latest of:
+
+        its time - max_lead_us
+        the end of the previous note on the same string (never re-fret a
+        string that is still sounding)
+        the end of the previous move of the same servo (travel + settle)
+
+    The presses of one chord move by the same amount, so they still land
+    together (and still fold into one pose trigger).
+
+    Then every pick in the song moves earlier by the same amount, as far as
+    the slowest fret in the song now allows, but never before its beat, so
+    the song's rhythm is untouched. Returns (records sorted by time, report)
+    where report gives the pick advance in us and how many fretted notes
+    have their fret settled by their pick, before and after.
+    """
+    neutral  = scheduler.neutral_angles(scheduler.calibration)
+    picks    = pick_servos()
+    pick_of  = {int(p["servo"]): name for name, p in scheduler.calibration["picking"].items()}
+    presses  = {}                                    # (servo, press angle) -> string.
+    for name, string in scheduler.calibration["fretting"].items():
+        for fret in string["frets"].values():
+            presses[(int(fret["servo"]), int(fret["press"]))] = name
+
+    # When each note's strings are free to be fretted again.
+    order       = sorted(range(len(notes)), key=lambda k: notes[k][0])
+    string_free = {}                                 # note -> {string: free from us}.
+    busy_until  = {}
+    for k in order:
+        start, end, recs = notes[k]
+        string_free[k] = dict(busy_until)
+        for _, servo, _ in recs:
+            if servo in pick_of:
+                name = pick_of[servo]
+                busy_until[name] = max(busy_until.get(name, 0), end)
+
+    flat = []                                        # (t, servo, angle, note, is_press).
+    note_presses = {}                                # note -> its presses.
+    for k, (_, _, recs) in enumerate(notes):
+        first = {}
+        for t, servo, angle in recs:
+            if servo not in picks and (servo not in first or t < first[servo]):
+                first[servo] = t
+        for t, servo, angle in recs:
+            is_press = (servo, angle) in presses and t == first.get(servo)
+            flat.append((t, servo, angle, k, is_press))
+            if is_press:
+                note_presses.setdefault(k, []).append((t, servo, angle))
+    flat.sort(key=lambda r: r[0])
+
+    angle, free_at, ready, before, out = {}, {}, {}, {}, []
+    moved_to = {}                                    # note -> time its presses move to.
+    for t, servo, new, k, is_press in flat:
+        old = angle.get(servo, neutral[servo] if servo < len(neutral) else new)
+        if is_press:
+            before[k] = max(before.get(k, 0), t + travel_us(servo, old, new))
+            if k not in moved_to:                    # A chord's presses move together.
+                moved_to[k] = max(max(p_t - max_lead_us, free_at.get(p_s, 0),
+                                      string_free[k].get(presses[(p_s, p_a)], 0))
+                                  for p_t, p_s, p_a in note_presses[k])
+            t = min(t, moved_to[k])
+        if servo < scheduler.NUM_SERVOS:
+            free_at[servo] = t + travel_us(servo, old, new)
+            angle[servo]   = new
+            if is_press:
+                ready[k] = max(ready.get(k, 0), free_at[servo])
+        out.append([t, servo, new, k])
+
+    # Uniform pick advance: what the least-prepared fretted note still needs.
+    need = max((ready[k] - notes[k][0] for k in ready), default=PICK_LEAD_US)
+    advance = max(0, PICK_LEAD_US - need)
+    if advance:
+        for r in out:
+            if r[1] in picks and r[0] - advance >= notes[r[3]][0]:
+                r[0] -= advance
+    records = sorted(((t, servo, angle) for t, servo, angle, _ in out), key=lambda r: r[0])
+    first_pick = {}
+    for t, servo, _, k in out:
+        if servo in picks and k in ready:
+            first_pick[k] = min(first_pick.get(k, t), t)
+    return records, {
+        "advance_us": advance,
+        "fretted":    len(first_pick),
+        "settled":    sum(1 for k in first_pick if ready[k] <= first_pick[k]),
+        "was":        sum(1 for k in first_pick if before[k] <= first_pick[k] + advance),
+    }
+
+# --- Tempo search -------------------------------------------------------------
+
+def max_tempo(score: dict, bpm_range: tuple = TEMPO_RANGE) -> int | None:
+    """
+    Fastest whole starting BPM in bpm_range at which the song has no
+    conflicts, or None if it conflicts even at the slowest. Tempo changes
+    scale along with it. Fixed ms offsets (strum sweep, fret lead) do not,
+    so the song is rebuilt per probe.
+    """
+    import songcompiler                               # Deferred: songcompiler imports this module.
+
+    base = songcompiler.song_tempo(score)
+
+    def clean(bpm):
+        tempo = base.scaled(bpm / base.initial_bpm)
+        return not find_conflicts(songcompiler.build_records(score, tempo))
+
+    lo, hi = bpm_range
+    if not clean(lo):
+        return None
+    if clean(hi):
+        return hi
+    while hi - lo > 1:                               # clean(lo) and not clean(hi).
+        mid = (lo + hi) // 2
+        if clean(mid):
+            lo = mid
+        else:
+            hi = mid
+    return lo
+
+def analyze(score: dict, auto_shift: bool = False) -> dict:
+    """
+    Full report for one song score: conflicts at the configured tempo
+    (after pick shifting, if asked) and the fastest conflict-free tempo.
+    """
+    import songcompiler                               # Deferred: songcompiler imports this module.
+
+    records = songcompiler.build_records(score)
+    shifts  = []
+    if auto_shift:
+        records, shifts = shift_picks(records)
+    return {
+        "bpm":       songcompiler.song_tempo(score).initial_bpm,
+        "records":   len(records),
+        "conflicts": find_conflicts(records),
+        "shifted":   [{"servo": s, "from_us": a, "to_us": b} for s, a, b in shifts],
+        "max_bpm":   max_tempo(score),
+    }
+
+def format_conflict(c: dict) -> str:
+    at = f"{c['time_us'] / 1000:9.1f} ms servo {c['servo']:2d}"
+    if c["kind"] == "slew":
+        return (f"{at}: move to {c['angle']} starts {c['shortfall_us'] / 1000:.1f} ms before "
+                f"the move at {c['prev_time_us'] / 1000:.1f} ms has finished")
+    return f"{at}: pressed to {c['angle']} while still holding {c['held_angle']}"
+
+def self_check() -> None:
+    """
+    Assert the overlap rule on hand-made records for one fret servo: a
+    release and the next press at the same instant is clean, a press
+    straight from one fret to another is not.
+    """
+    servo = 6
+    rest  = scheduler.neutral_angles(scheduler.calibration)[servo]
+    a, b  = (rest + 30, rest - 30) if rest <= 150 else (rest - 30, rest - 60)
+    clean = [(0, servo, a), (1_000_000, servo, rest), (1_000_000, servo, b)]
+    held  = [(0, servo, a), (1_000_000, servo, b)]
+    assert not [c for c in find_conflicts(clean) if c["kind"] == "overlap"], "release + press flagged"
+    assert [c for c in find_conflicts(held) if c["kind"] == "overlap"], "fret-to-fret press missed"
+    print("validator self-check passed")
+
+if __name__ == '__main__':
+    # Check songs: python3 validator.py [--shift] [song name ...]
+    #              python3 validator.py --self-check
+    import json, os, sys
+    args  = sys.argv[1:]
+    if "--self-check" in args:
+        self_check()
+        sys.exit(0)
+    shift = "--shift" in args
+    names = [a for a in args if a != "--shift"] or sorted(
+        n[:-5] for n in os.listdir("./songs") if n.endswith(".json"))
+    for name in names:
+        with open(os.path.join("./songs", f"{name}.json")) as f:
+            report = analyze(json.load(f), auto_shift=shift)
+        best = report["max_bpm"]
+        print(f"{name}: {len(report['conflicts'])} conflicts at {report['bpm']:g} BPM, "
+              f"{len(report['shifted'])} picks shifted, "
+              + (f"fastest clean tempo {best} BPM" if best is not None else "no clean tempo in range"))
+        for c in report["conflicts"]:
+            print("   ", format_conflict(c))